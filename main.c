@@ -1,9 +1,21 @@
+#define _GNU_SOURCE // O_DIRECT, sync_file_range
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -11,6 +23,12 @@
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// -H: 큰 버퍼에 MAP_HUGETLB(예약된 huge page)를 먼저 시도
+static int use_hugetlb = 0;
+
+// -D: 작업 스레드가 입력을 O_DIRECT로 읽음 (페이지 캐시를 거치지 않음)
+static int use_direct_io = 0;
+
 // -----------------------
 // 1. 구조체 정의
 // -----------------------
@@ -23,14 +41,244 @@ typedef struct Node {
     struct Node *right; // 오른쪽 자식 노드
 } Node;
 
+// 출력 파일의 write-behind 진행 상태
+// [dropped, started): 비동기 쓰기를 시작했지만 아직 캐시에 남은 구간
+typedef struct write_behind {
+    off_t started; // 비동기 쓰기를 시작한 끝 위치
+    off_t dropped; // 디스크에 반영하고 캐시에서 버린 끝 위치
+} write_behind;
+
 // 우선순위 큐 구조체 정의
+// min/max는 양 끝 노드를 가리키는 finger로, 회전은 노드를 옮기지 않으므로 삽입/삭제 때만 갱신
 typedef struct priority_queue {
     Node *root; // AVL 트리의 루트 노드
+    Node *min; // 중위 순서의 첫 노드 (비어 있으면 NULL)
+    Node *max; // 중위 순서의 마지막 노드 (비어 있으면 NULL)
 } priority_queue;
 
+// 동시 우선순위 큐의 샤드 개수 (키 범위로 분할)
+#define CPQ_SHARDS 16
+#define CPQ_SHARD_SHIFT 4 // 256 / CPQ_SHARDS = 16개 값씩 한 샤드
+
+// 한 번에 읽고 쓰는 배치 크기
+#define IO_CHUNK (64 * 1024)
+
+// 이 크기 이상의 버퍼는 mmap으로 할당해 huge page를 요청
+#define LARGE_PAGE_SIZE (2UL * 1024 * 1024)
+#define LARGE_ALLOC_MIN LARGE_PAGE_SIZE
+
+// 입력은 이만큼 앞서 WILLNEED로 미리 읽게 하고, 출력은 이만큼 쌓일 때마다 디스크로 내보냄
+#define READAHEAD_WINDOW (1024 * 1024)
+#define WRITE_BEHIND_WINDOW (8 * 1024 * 1024)
+
+// O_DIRECT 읽기의 버퍼, 위치, 길이 정렬 단위
+#define DIRECT_ALIGN 4096
+
+// 이 높이보다 낮은 트리의 합집합은 새 스레드 없이 순차 실행
+#define UNION_PAR_HEIGHT 12
+
+// 동시 우선순위 큐의 샤드: 키 범위 하나를 맡는 AVL 트리와 잠금
+typedef struct pq_shard {
+    _Alignas(64) pthread_mutex_t lock; // 샤드마다 캐시 라인을 따로 사용
+    Node *root;
+    atomic_size_t count; // 잠금 없이 읽을 수 있는 원소 수
+} pq_shard;
+
+// 생산자와 소비자가 동시에 접근할 수 있는 우선순위 큐
+//
+// 키 공간을 CPQ_SHARDS개의 연속 구간으로 나누고, 구간마다 별도 잠금을 가진
+// AVL 트리를 둔다. 샤드 i의 모든 키는 샤드 i + 1의 모든 키보다 작으므로
+// 최소값은 비어 있지 않은 첫 샤드의 최소값이다. 전역 잠금은 없다.
+//
+// 선형화 가능성:
+// - 샤드 하나에 대한 삽입/삭제는 샤드 잠금 안에서 일어나므로 선형화 가능하다.
+// - cpq_try_dequeue는 샤드를 오름차순으로 훑는다. 호출이 시작되기 전에 완료된
+//   삽입에 대해서는 항상 정확한 최소값을 반환한다. 호출과 겹쳐 실행된, 이미
+//   지나간 샤드로의 삽입은 앞지를 수 있다 (quiescent consistency).
+//   생산자가 모두 끝난 뒤의 pop은 엄밀한 최소값 순서를 따른다.
+// - cpq_dequeue_batch는 한 샤드 안에서 연속된 pop을 잠금 한 번으로 처리하며,
+//   개별 pop을 순서대로 실행한 것과 같다.
+// - cpq_dequeue_wait는 큐가 비어 있고 생산자가 남아 있으면 nonempty에서 잠든다.
+//   생산자는 size를 올린 뒤 waiters를 보고 깨우므로 (둘 다 seq_cst) 깨움을 놓치지 않는다.
+typedef struct concurrent_pq {
+    pq_shard shards[CPQ_SHARDS];
+    atomic_size_t size; // 전체 원소 수
+    atomic_int producers; // 아직 삽입 중인 생산자 수
+    atomic_int waiters; // nonempty에서 기다리는 소비자 수
+    pthread_mutex_t wait_lock;
+    pthread_cond_t nonempty; // 원소가 들어왔거나 생산자가 모두 끝남
+} concurrent_pq;
+
+// 1바이트 키 전용 우선순위 큐: 값별 개수와 256비트 점유 비트맵
+// 최소값은 비트맵의 첫 번째 1비트(tzcnt)로 O(1)에 찾고, 삽입/삭제는 개수만
+// 바꾸며 개수가 0을 지날 때만 비트를 뒤집는다. 비트맵은 캐시 라인 하나에 들어간다.
+typedef struct byte_queue {
+    uint64_t bits[4]; // 값 v가 하나 이상 있으면 bits[v / 64]의 (v % 64)번 비트가 1
+    size_t size; // 전체 원소 수
+    size_t counts[256]; // 값별 원소 수
+} byte_queue;
+
+// 정렬 엔진 종류
+typedef enum sort_engine {
+    ENGINE_CPQ, // 동시 우선순위 큐에 바로 삽입 (기본)
+    ENGINE_MERGE, // 스레드마다 트리를 일괄 생성한 뒤 join 기반 합집합으로 결합
+    ENGINE_BITMAP, // 스레드마다 byte_queue에 센 뒤 개수를 합침
+    ENGINE_COPY, // 이미 오름차순: 검증 후 그대로 복사
+    ENGINE_REVERSE, // 내림차순: 검증 후 뒤집어 기록
+    ENGINE_WIDE, // 4바이트 키: 스레드마다 비트닉 네트워크로 정렬된 런을 만든 뒤 병합
+    ENGINE_AUTO // 표본 조사로 위 엔진 중 하나를 고름
+} sort_engine;
+
+// 4바이트 키 블록 정렬 단위 (AVX2 레지스터 8개 = 8 x 8 레인)
+#define WIDE_BLOCK 64
+
+// 4바이트 키 정렬 작업: 픽셀 영역의 연속 구간 하나를 정렬된 런으로 만듦
+typedef struct wide_arg {
+    char *file_name;
+    off_t offset; // 파일에서 구간 시작 위치
+    uint32_t *keys; // 구간의 키 (정렬 결과도 여기에)
+    uint32_t *tmp; // 병합용 보조 버퍼 (keys와 같은 크기)
+    size_t count;
+} wide_arg;
+
+// merge path 병합 작업: 최종 출력의 [begin, end) 구간 하나를 맡음
+typedef struct merge_path_arg {
+    uint32_t **runs; // 정렬된 런들
+    size_t *lens;
+    int k; // 런 개수
+    size_t begin;
+    size_t end;
+    uint32_t *out; // 최종 출력 (전체 크기)
+    uint32_t *scratch; // 보조 버퍼 (전체 크기, 같은 구간만 사용)
+} merge_path_arg;
+
+// 엔진 자동 선택을 위한 표본 조사 범위
+#define SAMPLE_BLOCKS 64
+#define SAMPLE_BLOCK_SIZE 4096
+
+// 표본 조사 결과
+typedef struct sample_stats {
+    off_t size; // 픽셀 영역 크기
+    size_t sampled; // 읽은 바이트 수
+    size_t pairs; // 비교한 인접 쌍 수 (블록 경계 포함)
+    size_t ascending; // a <= b 인 쌍 수
+    size_t descending; // a >= b 인 쌍 수
+    size_t runs; // 오름차순 런 개수 (내림이 일어난 횟수 + 1)
+    size_t distinct; // 표본에 나타난 서로 다른 값 수
+    int key_bytes; // 키 크기 (1 또는 4)
+} sample_stats;
+
+// 병렬 합집합 작업 (fork-join 재귀의 한쪽 가지)
+typedef struct union_task {
+    Node *a;
+    Node *b;
+    Node *result;
+    int depth; // 남은 분기 깊이, 0이면 순차 실행
+} union_task;
+
+// 결과 캐시 항목의 기본 크기 제한 (바이트)
+#define CACHE_DEFAULT_LIMIT (256ULL * 1024 * 1024)
+
+// 캐시 항목에 저장된 결과의 형태
+#define CACHE_PAYLOAD_COUNTS 1 // 값별 개수 256개 (uint64_t), 출력은 개수로부터 재생성
+
+// 정렬 방식 식별자 (캐시 키에 포함)
+#define SORT_MODE_GLOBAL 1 // 픽셀 영역 전체를 하나의 수열로 오름차순 정렬
+#define SORT_MODE_ROWS 2 // 행(스캔라인)마다 따로 정렬
+#define SORT_MODE_TILES 3 // W x H 타일마다 따로 정렬
+
+// 이 크기 이하의 구간은 히스토그램 대신 삽입 정렬
+#define SMALL_SORT_MAX 32
+
+// 결과 캐시 항목 파일의 머리말, 뒤에 결과가 이어짐
+typedef struct cache_entry_header {
+    char magic[8]; // "PSCACHE1"
+    uint64_t key; // 정렬 방식, 헤더, 픽셀 영역의 해시
+    uint64_t region_size; // 픽셀 영역 크기 (해시 충돌 확인용)
+    uint32_t payload_type; // CACHE_PAYLOAD_*
+    uint32_t reserved;
+} cache_entry_header;
+
+// 증분 정렬 상태 파일 머리말, 뒤에 uint64_t 값별 개수 256개가 이어짐
+// 입력 키는 어떤 입력에서 만든 상태인지, 출력 키는 상태가 설명하는 출력이 지금 디스크의 출력과 같은지 확인용
+typedef struct sort_state_header {
+    char magic[8]; // "PSSTATE2"
+    uint64_t input_key; // 출력을 만든 입력의 cache_key
+    uint64_t region_size; // 픽셀 영역 크기
+    uint64_t output_key; // 출력 파일 전체(헤더 + 정렬된 영역)의 hash_bytes
+    uint64_t output_size; // 출력 파일 크기
+} sort_state_header;
+
+// LRU 제거를 위한 캐시 디렉터리 항목
+typedef struct cache_file {
+    char *path;
+    off_t size;
+    time_t mtime;
+} cache_file;
+
+// BMP 헤더에서 읽은 픽셀 배치 정보
+typedef struct bmp_info {
+    off_t offset; // 픽셀 데이터 시작 위치
+    int32_t width;
+    int32_t height; // 음수면 위에서 아래로 저장
+    uint16_t bpp; // 픽셀당 비트 수
+    uint32_t compression; // 0: BI_RGB, 1: BI_RLE8, 3: BI_BITFIELDS ...
+    size_t rows; // 행 개수 (|height|)
+    size_t stride; // 파일에서 한 행이 차지하는 바이트 수 (4바이트 정렬)
+    size_t row_bytes; // 한 행에서 패딩을 뺀 픽셀 바이트 수
+} bmp_info;
+
+// 행/타일 정렬 작업: 연속된 행 묶음(band) 하나를 맡음
+typedef struct band_arg {
+    char *file_name;
+    const bmp_info *info;
+    unsigned char *region; // 픽셀 영역 전체 버퍼 (각 스레드는 자기 band만 접근)
+    int mode; // SORT_MODE_ROWS 또는 SORT_MODE_TILES
+    int tile_w;
+    int tile_h;
+    size_t row_begin;
+    size_t row_end;
+} band_arg;
+
+// 순열 파일 머리말, 뒤에 index_bytes 크기의 인덱스 count개가 이어짐 (리틀 엔디언)
+typedef struct perm_header {
+    char magic[8]; // "PSPERM01"
+    uint32_t index_bytes; // 4 또는 8
+    uint32_t reserved;
+    uint64_t count; // 원소 수
+} perm_header;
+
+// argsort 작업: 픽셀 영역의 연속 구간 하나를 맡음
+typedef struct argsort_arg {
+    unsigned char *region;
+    int fd; // 1단계에서 자기 구간을 직접 읽어 들임 (first touch)
+    off_t offset; // 파일 안에서 region[0]의 위치
+    size_t begin;
+    size_t end;
+    size_t counts[256]; // 1단계: 구간의 값별 개수, 2단계: 값별 다음 출력 위치
+    void *perm; // uint32_t 또는 uint64_t 배열
+    int index_bytes;
+} argsort_arg;
+
+// BI_RLE8 인코더: 정렬된 수열을 런 단위로 받아 행 단위 RLE8 데이터를 메모리에 쌓음
+typedef struct rle8_writer {
+    size_t width; // 행당 픽셀 수
+    size_t stride; // 비압축 출력에서 한 행이 차지하는 바이트 수 (패딩 포함)
+    size_t rows;
+    size_t pos; // 비압축 출력 기준으로 지금까지 소비한 위치
+    int pending_value; // 아직 인코딩하지 않은 런의 값 (-1이면 없음)
+    size_t pending_count;
+    unsigned char *buf; // 인코딩된 데이터
+    size_t len;
+    size_t cap;
+} rle8_writer;
+
 typedef struct thread_arg {
     char *file_name;
-    priority_queue *pq_ptr;
+    sort_engine engine;
+    concurrent_pq *cpq_ptr;
+    priority_queue *pq_ptr; // ENGINE_MERGE에서 스레드가 소유하는 큐
+    byte_queue *bq_ptr; // ENGINE_BITMAP에서 스레드가 소유하는 큐
     off_t quota;
     off_t offset;
 } thread_arg;
@@ -48,6 +296,13 @@ void enqueue(priority_queue *pq, unsigned char data);
 // 삭제 연산 (dequeue)
 unsigned char dequeue(priority_queue *pq);
 
+// 가장 큰 원소 삭제 (양방향 우선순위 큐)
+unsigned char dequeue_max(priority_queue *pq);
+
+// 가장 작은/큰 원소 조회 (finger로 O(1))
+unsigned char peek(priority_queue *pq);
+unsigned char peek_max(priority_queue *pq);
+
 // 루트 노드 반환
 Node *get_root(priority_queue *pq);
 
@@ -77,14 +332,240 @@ static Node *rotate_left(Node *x);
 // 노드 생성
 static Node *create_node(unsigned char data);
 
-// 삽입 연산 (오름차순 정렬)
-static Node *insert_node(Node *node, unsigned char data);
+// 삽입 연산 (오름차순 정렬), created가 NULL이 아니면 새 노드를 돌려줌
+static Node *insert_node(Node *node, unsigned char data, Node **created);
 
 // 가장 큰 값의 노드 찾기 (우선순위가 가장 높은 원소)
 static Node *find_min(Node *node);
 
-// 삭제 연산 (우선순위가 가장 높은 원소 제거)
-static Node *delete_min(Node *node);
+// 가장 큰 값의 노드 찾기
+static Node *find_max(Node *node);
+
+// 삭제 연산 (우선순위가 가장 높은 원소 제거), next가 NULL이 아니면 새 최소 노드를 돌려줌
+static Node *delete_min(Node *node, Node **next);
+
+// 가장 큰 원소 제거, prev가 NULL이 아니면 새 최대 노드를 돌려줌
+static Node *delete_max(Node *node, Node **prev);
+
+// 높이 갱신 후 균형 조정
+static Node *rebalance(Node *node);
+
+// 트리를 통째로 바꾼 뒤 min/max finger를 다시 찾음
+static void refresh_fingers(priority_queue *pq);
+
+// 정렬된 배열로부터 균형 잡힌 트리를 O(n)에 생성 (기존 원소는 해제)
+// 전역 mutex를 잡지 않으므로 pq는 호출한 스레드만 사용 중이어야 함
+void build_priority_queue(priority_queue *pq, const unsigned char *sorted, size_t n);
+
+// src의 모든 원소를 dst로 옮김 (join 기반 합집합, 최대 2^depth개 스레드로 병렬)
+// build_priority_queue와 마찬가지로 두 큐를 다른 스레드가 동시에 쓰지 않아야 함
+void merge_priority_queue(priority_queue *dst, priority_queue *src, int depth);
+
+// 트리의 원소를 오름차순으로 out에 복사, 복사한 개수 반환
+size_t tree_to_array(Node *root, unsigned char *out);
+
+// 정렬된 배열의 [lo, hi) 구간으로 균형 트리 생성
+static Node *build_balanced(const unsigned char *sorted, size_t lo, size_t hi);
+
+// left의 모든 원소 <= key <= right의 모든 원소일 때 세 부분을 AVL 트리로 결합
+static Node *join_tree(Node *left, Node *key, Node *right);
+
+// left가 right보다 높을 때 left의 오른쪽 경계를 따라 내려가며 결합
+static Node *join_right(Node *left, Node *key, Node *right);
+
+// right가 left보다 높을 때 right의 왼쪽 경계를 따라 내려가며 결합
+static Node *join_left(Node *left, Node *key, Node *right);
+
+// key보다 작은 원소는 left로, 크거나 같은 원소는 right로 분할
+static void split_tree(Node *node, unsigned char key, Node **left, Node **right);
+
+// 두 트리의 합집합 (중복 허용), depth > 0이면 왼쪽 가지를 새 스레드에서 실행
+static Node *union_tree(Node *a, Node *b, int depth);
+
+static void *union_task_func(void *arg);
+
+// 바이트 큐 초기화
+void init_byte_queue(byte_queue *bq);
+
+// 바이트 큐가 비어 있는지 확인
+int bq_is_empty(byte_queue *bq);
+
+// 값 data를 count개 삽입
+void bq_enqueue_n(byte_queue *bq, unsigned char data, size_t count);
+
+// 삽입 연산 (enqueue)
+void bq_enqueue(byte_queue *bq, unsigned char data);
+
+// 최소값 확인 (peek)
+unsigned char bq_peek(byte_queue *bq);
+
+// 삭제 연산 (dequeue)
+unsigned char bq_dequeue(byte_queue *bq);
+
+// 최소값부터 최대 max개를 꺼내 out에 오름차순으로 저장, 꺼낸 개수 반환
+size_t bq_dequeue_batch(byte_queue *bq, unsigned char *out, size_t max);
+
+// src의 원소를 dst에 더함 (src는 그대로)
+void bq_merge(byte_queue *dst, const byte_queue *src);
+
+// 최소값을 모두 꺼내 그 값을 value에 저장하고 개수를 반환
+size_t bq_dequeue_run(byte_queue *bq, unsigned char *value);
+
+// 비트맵에서 가장 작은 값 찾기 (큐가 비어 있지 않아야 함)
+static inline int bq_find_min(const byte_queue *bq);
+
+// 동시 우선순위 큐 초기화
+void init_concurrent_pq(concurrent_pq *cpq);
+
+// 동시 우선순위 큐의 모든 노드 해제
+void destroy_concurrent_pq(concurrent_pq *cpq);
+
+// 생산자 등록/해제 (소비자는 생산자가 모두 끝났는지로 종료를 판단)
+void cpq_producer_begin(concurrent_pq *cpq);
+
+void cpq_producer_end(concurrent_pq *cpq);
+
+// 원소 하나 삽입
+void cpq_enqueue(concurrent_pq *cpq, unsigned char data);
+
+// 여러 원소 삽입 (샤드마다 잠금을 한 번만 잡음)
+void cpq_enqueue_batch(concurrent_pq *cpq, const unsigned char *data, size_t n);
+
+// 최소값 하나 꺼내기, 비어 있으면 0 반환
+int cpq_try_dequeue(concurrent_pq *cpq, unsigned char *out);
+
+// 최소값부터 최대 max개를 꺼내 out에 오름차순으로 저장, 꺼낸 개수 반환
+size_t cpq_dequeue_batch(concurrent_pq *cpq, unsigned char *out, size_t max);
+
+// 생산자가 모두 끝났고 큐가 비었는지 확인
+int cpq_is_drained(concurrent_pq *cpq);
+
+// cpq_dequeue_batch와 같지만 비어 있으면 원소가 들어올 때까지 기다림, 0이면 모두 소진
+size_t cpq_dequeue_wait(concurrent_pq *cpq, unsigned char *out, size_t max);
+
+// 부분 쓰기와 EINTR을 처리하며 버퍼 전체를 기록
+int write_full(int fd, const unsigned char *buf, size_t len);
+
+// 출력이 WRITE_BEHIND_WINDOW 이상 쌓이면 새 구간의 쓰기를 시작하고, 앞 구간은 기다렸다가 캐시에서 버림
+void write_behind_step(int fd, write_behind *wb);
+
+// 출력 파일 전체를 디스크에 반영한 뒤 캐시에서 버림 (close 직전에 호출)
+void drop_output_cache(int fd);
+
+// 큰 버퍼 할당: huge page를 요청하고, 페이지는 처음 쓰는 스레드의 노드에 놓이도록 건드리지 않음
+void *alloc_large(size_t size);
+
+// alloc_large로 할당한 버퍼 해제 (할당할 때와 같은 size)
+void free_large(void *ptr, size_t size);
+
+// EINTR을 처리하며 offset부터 len 바이트를 모두 읽음
+int read_full(int fd, unsigned char *buf, size_t len, off_t offset);
+
+// 64비트 해시 (XXH64 알고리즘)
+uint64_t hash_bytes(const unsigned char *data, size_t len, uint64_t seed);
+
+// 정렬 방식, BMP 헤더, 픽셀 영역으로 캐시 키 계산
+uint64_t cache_key(int mode, const unsigned char *header, size_t header_len,
+                   const unsigned char *region, size_t region_len);
+
+// 캐시 항목을 찾아 값별 개수를 bq에 채움, 적중하면 1 반환
+int cache_lookup(const char *dir, uint64_t key, size_t region_len, byte_queue *bq);
+
+// 값별 개수를 캐시에 저장 (임시 파일에 쓴 뒤 rename으로 원자적 공개)
+int cache_store(const char *dir, uint64_t key, size_t region_len, const size_t *counts,
+                unsigned long long limit);
+
+// 캐시 디렉터리 크기가 limit 이하가 될 때까지 오래 쓰지 않은 항목부터 삭제
+void cache_evict(const char *dir, unsigned long long limit);
+
+// 증분 정렬 상태 (<output>.state): 입력 키가 맞으면 머리말과 값별 개수를 채우고 0 반환
+int state_load(const char *output, uint64_t input_key, size_t region_len, sort_state_header *header,
+               size_t *counts);
+
+// file_buf(헤더 + 픽셀 영역)를 오름차순 정렬한 출력에 대한 상태를 저장
+int state_save(const char *output, const unsigned char *file_buf, size_t header_len, size_t region_len);
+
+// 입력 파일을 읽어 state_save (출력을 큐를 거치지 않고 만든 경우)
+int state_save_from_input(char *input, char *output);
+
+// 상태를 저장하지 않는 실행이 출력을 덮어쓰므로 남아 있는 <output>.state를 지움
+void state_discard(const char *output);
+
+// 두 영역을 비교해 바뀐 바이트마다 delta[이전 값]--, delta[새 값]++, 바뀐 바이트 수 반환
+size_t diff_regions(const unsigned char *old_region, const unsigned char *new_region, size_t len,
+                    int64_t *delta);
+
+// old_input을 정렬한 출력과 상태 파일을 input에 맞게 고침
+// 값별 런의 경계가 움직인 위치만 다시 쓰고 1 반환, 전체 정렬이 필요하면 0
+int run_incremental(char *old_input, char *input, char *output);
+
+// BMP 헤더를 읽어 픽셀 배치 정보를 채움, 지원하지 않는 형식이면 -1
+int find_bmp_info(char *file_name, bmp_info *info);
+
+// 작은 바이트 구간 정렬 (삽입 정렬 또는 지역 히스토그램)
+void sort_bytes_small(unsigned char *data, size_t n);
+
+// 행 또는 타일 단위로 병렬 정렬 후 출력, 성공하면 0
+int run_band_sort(char *input, char *output, int mode, int tile_w, int tile_h, int n);
+
+void *band_thread_func(void *arg);
+
+// 픽셀 영역의 안정 순열(argsort)을 병렬 계수 정렬로 구해 perm_file에 저장하고
+// 정렬된 이미지를 output에 기록, 성공하면 0
+int run_argsort(char *input, char *output, char *perm_file, int index_bytes, int n);
+
+// perm_file의 순열로 input의 픽셀 영역을 재배열해 output에 기록, 성공하면 0
+int run_apply_permutation(char *input, char *output, char *perm_file);
+
+void *argsort_count_func(void *arg);
+
+void *argsort_scatter_func(void *arg);
+
+// RLE8 인코더 초기화 (8비트, 비압축, 아래에서 위로 저장된 BMP만 가능)
+void rle8_init(rle8_writer *w, const bmp_info *info);
+
+// 값 value가 count개 이어지는 런 추가
+void rle8_put_run(rle8_writer *w, unsigned char value, size_t count);
+
+// 정렬된 바이트 배열 추가 (같은 값끼리 런으로 묶음)
+void rle8_put_bytes(rle8_writer *w, const unsigned char *data, size_t len);
+
+// 헤더의 압축 방식과 크기 필드를 고쳐 헤더와 인코딩된 데이터를 기록, 실패하면 -1
+int rle8_finish(rle8_writer *w, int fd, unsigned char *header, size_t header_len);
+
+// 정렬된 바이트를 rle가 있으면 RLE8로, 없으면 그대로 기록
+int emit_bytes(int fd, rle8_writer *rle, const unsigned char *data, size_t len);
+
+// 픽셀 영역에서 고르게 떨어진 블록을 읽어 정렬 상태와 값 분포를 측정 (key_bytes: 1 또는 4)
+void sample_region(char *file_name, off_t offset, off_t size, int key_bytes, sample_stats *stats);
+
+// 표본 조사 결과로 엔진을 고르고 이유를 reason에 기록
+sort_engine choose_engine(const sample_stats *stats, char *reason, size_t reason_len);
+
+// 영역 전체가 단조인지 확인한 뒤 그대로(또는 키 단위로 뒤집어) 출력, 단조가 아니면 0 반환
+int run_copy_through(char *input, char *output, int key_bytes, int reverse);
+
+// CPU 기능을 확인해 4바이트 키 커널을 고름 (AVX2 또는 스칼라)
+void init_simd_dispatch(void);
+
+// 4바이트 키 n개를 오름차순 정렬 (tmp는 n개 크기의 보조 버퍼)
+void sort_run_u32(uint32_t *keys, uint32_t *tmp, size_t n);
+
+// 32비트 BGRA 픽셀을 4바이트 키로 보고 영역 전체를 정렬, 성공하면 0
+int run_wide_sort(char *input, char *output, int n);
+
+void *wide_thread_func(void *arg);
+
+// 정렬된 런 k개를 합친 결과에서 앞쪽 target개가 각 런의 어디까지인지 split에 기록 (co-rank)
+void co_rank(uint32_t **runs, const size_t *lens, int k, size_t target, size_t *split);
+
+// 정렬된 런 k개를 n개 스레드가 출력 구간을 나누어 병렬로 병합
+void merge_runs_parallel(uint32_t **runs, size_t *lens, int k, uint32_t *out, uint32_t *scratch, int n);
+
+// sort_run_u32와 merge_runs_parallel을 스칼라/AVX2 커널 각각으로 qsort 결과와 비교, 실패한 경우 수 반환
+int run_self_test(void);
+
+void *merge_path_func(void *arg);
 
 void *thread_func(void *arg);
 
@@ -100,14 +581,260 @@ int main(int argc, char *argv[]) {
     int n = 1;
     char *string = "673aef41575027558828.bmp";
     char *string2 = "output.bmp";
-    priority_queue pq;
-    init_priority_queue(&pq);
+    sort_engine engine = ENGINE_CPQ;
+    concurrent_pq cpq;
+    init_concurrent_pq(&cpq);
+    priority_queue *pqs;
+    byte_queue *bqs;
     thread_arg **thread_args;
     pthread_t *thread_ids;
     int status;
     int read_fd;
     int write_fd;
-    unsigned char buf;
+    unsigned char *out_buf;
+    char *cache_dir = NULL;
+    unsigned long long cache_limit = CACHE_DEFAULT_LIMIT;
+    unsigned char *file_buf = NULL;
+    uint64_t key = 0;
+    int cache_hit = 0;
+    int mode = SORT_MODE_GLOBAL;
+    int tile_w = 16;
+    int tile_h = 16;
+    char *perm_out = NULL;
+    char *perm_in = NULL;
+    int index_bytes = 0;
+    int rle_output = 0;
+    int descending = 0;
+    int save_state = 0;
+    int self_test = 0;
+    char *old_input = NULL;
+    rle8_writer rle;
+    rle8_writer *rle_ptr = NULL;
+    int key_bytes = 1;
+    int opt;
+
+    // 사용법: main [-t 스레드 수] [-e pq|merge|bitmap|auto] [-c 캐시 디렉터리] [-C 캐시 크기 제한]
+    //             [-m global|rows|tiles] [-T 타일 너비x높이]
+    //             [-a 순열 출력 파일] [-w 32|64] [-p 적용할 순열 파일] [-r] [-k 8|32] [-H] [-D] [-d]
+    //             [-S] [-u 이전 입력 파일] [-X]
+    //             [입력 파일] [출력 파일]
+    while ((opt = getopt(argc, argv, "t:e:c:C:m:T:a:w:p:rk:HDdSu:X")) != -1) {
+        switch (opt) {
+            case 't':
+                n = atoi(optarg);
+                break;
+            case 'e':
+                if (strcmp(optarg, "pq") == 0) {
+                    engine = ENGINE_CPQ;
+                } else if (strcmp(optarg, "merge") == 0) {
+                    engine = ENGINE_MERGE;
+                } else if (strcmp(optarg, "bitmap") == 0) {
+                    engine = ENGINE_BITMAP;
+                } else if (strcmp(optarg, "auto") == 0) {
+                    engine = ENGINE_AUTO;
+                } else {
+                    fprintf(stderr, "알 수 없는 엔진: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'c':
+                cache_dir = optarg;
+                break;
+            case 'C':
+                cache_limit = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                if (strcmp(optarg, "global") == 0) {
+                    mode = SORT_MODE_GLOBAL;
+                } else if (strcmp(optarg, "rows") == 0) {
+                    mode = SORT_MODE_ROWS;
+                } else if (strcmp(optarg, "tiles") == 0) {
+                    mode = SORT_MODE_TILES;
+                } else {
+                    fprintf(stderr, "알 수 없는 정렬 방식: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                if (sscanf(optarg, "%dx%d", &tile_w, &tile_h) != 2 || tile_w < 1 || tile_h < 1) {
+                    fprintf(stderr, "잘못된 타일 크기: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'a':
+                perm_out = optarg;
+                break;
+            case 'w':
+                index_bytes = atoi(optarg) / 8;
+                if (index_bytes != 4 && index_bytes != 8) {
+                    fprintf(stderr, "인덱스 크기는 32 또는 64여야 합니다: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'p':
+                perm_in = optarg;
+                break;
+            case 'r':
+                rle_output = 1;
+                break;
+            case 'k':
+                key_bytes = atoi(optarg) / 8;
+                if (key_bytes != 1 && key_bytes != 4) {
+                    fprintf(stderr, "키 크기는 8 또는 32여야 합니다: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'H':
+                use_hugetlb = 1;
+                break;
+            case 'D':
+                use_direct_io = 1;
+                break;
+            case 'd':
+                descending = 1;
+                break;
+            case 'S':
+                save_state = 1;
+                break;
+            case 'u':
+                old_input = optarg;
+                save_state = 1;
+                break;
+            case 'X':
+                self_test = 1;
+                break;
+            default:
+                fprintf(stderr, "사용법: %s [-t 스레드 수] [-e pq|merge|bitmap|auto] [-c 캐시 디렉터리] "
+                        "[-C 캐시 크기 제한] [-m global|rows|tiles] [-T 타일 너비x높이] "
+                        "[-a 순열 출력 파일] [-w 32|64] [-p 적용할 순열 파일] [-r] [-k 8|32] [-H] [-D] [-d] "
+                        "[-S] [-u 이전 입력 파일] [-X] "
+                        "[입력 파일] [출력 파일]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (n < 1)
+        n = 1;
+
+    if (optind < argc)
+        string = argv[optind++];
+    if (optind < argc)
+        string2 = argv[optind++];
+    init_simd_dispatch();
+
+    // -X: 4바이트 키 커널 자체 검사 (ctest에서 실행)
+    if (self_test) {
+        destroy_concurrent_pq(&cpq);
+        return run_self_test() == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // 내림차순 출력은 양방향 우선순위 큐(merge 엔진)에서 최대값부터 꺼내어 만듦
+    if (descending && (engine != ENGINE_MERGE || key_bytes != 1 || mode != SORT_MODE_GLOBAL ||
+                       cache_dir != NULL || perm_in != NULL || perm_out != NULL)) {
+        fprintf(stderr, "내림차순 출력(-d)은 merge 엔진의 전체 정렬에서만 지원합니다.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // 증분 정렬 상태는 값별 개수이므로 비압축 오름차순 전체 정렬 출력에만 대응
+    if (save_state && (key_bytes != 1 || mode != SORT_MODE_GLOBAL || rle_output || descending ||
+                       perm_in != NULL || perm_out != NULL)) {
+        fprintf(stderr, "상태 저장(-S)과 증분 정렬(-u)은 1바이트 키의 오름차순 전체 정렬에서만 지원합니다.\n");
+        exit(EXIT_FAILURE);
+    }
+    // 이 실행이 출력을 덮어쓰므로 상태를 새로 저장하지 않을 거라면 이전 상태를 지움
+    if (!save_state)
+        state_discard(string2);
+    if (old_input != NULL && run_incremental(old_input, string, string2)) {
+        destroy_concurrent_pq(&cpq);
+        return 0;
+    }
+
+    // 4바이트 키: 전체 정렬만 지원, auto이면 복사/뒤집기/wide 중에서 고름
+    if (key_bytes == 4) {
+        destroy_concurrent_pq(&cpq);
+        if (mode != SORT_MODE_GLOBAL || rle_output || cache_dir != NULL || perm_in != NULL || perm_out != NULL) {
+            fprintf(stderr, "4바이트 키는 전체 정렬만 지원합니다.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (engine == ENGINE_AUTO) {
+            sample_stats stats;
+            char reason[256];
+            sample_region(string, find_offset(string), find_size(n, string), key_bytes, &stats);
+            engine = choose_engine(&stats, reason, sizeof(reason));
+            fprintf(stderr, "엔진 선택: %s (%s)\n",
+                    engine == ENGINE_COPY ? "copy" : engine == ENGINE_REVERSE ? "reverse" : "wide", reason);
+            if ((engine == ENGINE_COPY || engine == ENGINE_REVERSE) &&
+                run_copy_through(string, string2, key_bytes, engine == ENGINE_REVERSE))
+                return 0;
+            if (engine == ENGINE_COPY || engine == ENGINE_REVERSE)
+                fprintf(stderr, "엔진 선택: wide (전체 검증에서 단조가 아님을 확인)\n");
+        }
+        return run_wide_sort(string, string2, n) == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // 순열 적용/argsort와 행/타일 정렬은 전역 우선순위 큐를 거치지 않음
+    if (perm_in != NULL) {
+        destroy_concurrent_pq(&cpq);
+        return run_apply_permutation(string, string2, perm_in) == 0 ? 0 : EXIT_FAILURE;
+    }
+    if (perm_out != NULL) {
+        destroy_concurrent_pq(&cpq);
+        return run_argsort(string, string2, perm_out, index_bytes, n) == 0 ? 0 : EXIT_FAILURE;
+    }
+    if (mode != SORT_MODE_GLOBAL) {
+        destroy_concurrent_pq(&cpq);
+        return run_band_sort(string, string2, mode, tile_w, tile_h, n) == 0 ? 0 : EXIT_FAILURE;
+    }
+
+    // RLE8 출력은 8비트 팔레트, 비압축, 아래에서 위로 저장된 BMP에서만 가능
+    if (rle_output) {
+        bmp_info info;
+        if (find_bmp_info(string, &info) < 0 || info.bpp != 8 || info.compression != 0 || info.height < 0 ||
+            (off_t) (info.rows * info.stride) > find_size(n, string)) {
+            fprintf(stderr, "RLE8 출력은 8비트 비압축 BMP(아래에서 위로 저장)만 지원합니다.\n");
+            exit(EXIT_FAILURE);
+        }
+        rle8_init(&rle, &info);
+        rle_ptr = &rle;
+    }
+
+    // 자동 선택: 표본 조사 후 결정과 이유를 stderr에 남김
+    if (engine == ENGINE_AUTO) {
+        sample_stats stats;
+        char reason[256];
+        sample_region(string, find_offset(string), find_size(n, string), key_bytes, &stats);
+        engine = choose_engine(&stats, reason, sizeof(reason));
+        if (rle_ptr != NULL && (engine == ENGINE_COPY || engine == ENGINE_REVERSE)) {
+            engine = ENGINE_BITMAP;
+            strncat(reason, ", RLE8 출력은 값별 개수에서 런을 만듦", sizeof(reason) - strlen(reason) - 1);
+        }
+        fprintf(stderr, "엔진 선택: %s (%s)\n",
+                engine == ENGINE_COPY ? "copy" : engine == ENGINE_REVERSE ? "reverse" : "counting", reason);
+
+        if (engine == ENGINE_COPY || engine == ENGINE_REVERSE) {
+            if (run_copy_through(string, string2, key_bytes, engine == ENGINE_REVERSE)) {
+                if (save_state && state_save_from_input(string, string2) < 0)
+                    perror("state");
+                destroy_concurrent_pq(&cpq);
+                return 0;
+            }
+            fprintf(stderr, "엔진 선택: counting (전체 검증에서 단조가 아님을 확인)\n");
+            engine = ENGINE_BITMAP;
+        }
+    }
+
+    // 전역 정렬용 큐는 위의 다른 방식들로 빠져나간 뒤에만 할당
+    pqs = (priority_queue *) malloc(n * sizeof(priority_queue));
+    bqs = (byte_queue *) malloc(n * sizeof(byte_queue));
+    if (pqs == NULL || bqs == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        init_priority_queue(&pqs[i]);
+    }
+    for (int i = 0; i < n; i++) {
+        init_byte_queue(&bqs[i]);
+    }
 
     thread_args = (thread_arg **) malloc(n * sizeof(thread_arg *));
     for (int i = 0; i < n; i++) {
@@ -119,17 +846,49 @@ int main(int argc, char *argv[]) {
     off_t start_offset = find_offset(string);
     for (int i = 0; i < n - 1; i++) {
         thread_args[i]->file_name = string;
-        thread_args[i]->pq_ptr = &pq;
+        thread_args[i]->engine = engine;
+        thread_args[i]->cpq_ptr = &cpq;
+        thread_args[i]->pq_ptr = &pqs[i];
+        thread_args[i]->bq_ptr = &bqs[i];
         thread_args[i]->quota = quota;
         thread_args[i]->offset = start_offset + i * quota;
     }
     thread_args[n - 1]->file_name = string;
-    thread_args[n - 1]->pq_ptr = &pq;
+    thread_args[n - 1]->engine = engine;
+    thread_args[n - 1]->cpq_ptr = &cpq;
+    thread_args[n - 1]->pq_ptr = &pqs[n - 1];
+    thread_args[n - 1]->bq_ptr = &bqs[n - 1];
     thread_args[n - 1]->quota = size - (n - 1) * quota;
     thread_args[n - 1]->offset = start_offset + (n - 1) * quota;
 
+    // 결과 캐시: 같은 헤더와 픽셀 영역을 이미 정렬했다면 값별 개수로 출력을 재생성
+    // 증분 정렬 상태도 같은 키를 쓰므로 상태를 저장할 때도 입력 전체를 읽어 둠
+    if (cache_dir != NULL || save_state) {
+        int fd = open(string, O_RDONLY | O_BINARY);
+        file_buf = (unsigned char *) alloc_large((size_t) (start_offset + size));
+        if (fd < 0 || file_buf == NULL) {
+            perror("open");
+            exit(EXIT_FAILURE);
+        }
+        if (read_full(fd, file_buf, (size_t) (start_offset + size), 0) < 0) {
+            perror("read");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+        close(fd);
+
+        key = cache_key(SORT_MODE_GLOBAL, file_buf, (size_t) start_offset,
+                        file_buf + start_offset, (size_t) size);
+        if (cache_dir != NULL && cache_lookup(cache_dir, key, (size_t) size, &bqs[0])) {
+            cache_hit = 1;
+            engine = ENGINE_BITMAP;
+        }
+    }
+
     thread_ids = (pthread_t *) malloc(n * sizeof(pthread_t));
-    for (int i = 0; i < n; ++i) {
+    for (int i = 0; i < n && !cache_hit; ++i) {
+        if (engine == ENGINE_CPQ)
+            cpq_producer_begin(&cpq);
         status = pthread_create(&thread_ids[i], NULL, thread_func, thread_args[i]);
 
         if (status != 0) {
@@ -138,7 +897,27 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    for (int i = 0; i < n; ++i) {
+    // ENGINE_CPQ: 생산자가 삽입하는 동안 메인 스레드가 소비자로 최소값을 꺼냄
+    // 정렬된 출력 위치는 마지막 생산자가 끝나야 확정되므로, 꺼낸 배치는 값별 개수로 접어 bqs[0]에 둔다.
+    // 샤드 트리는 소비 속도만큼만 자라므로 삽입 비용과 노드 메모리가 입력 크기에 비례해 커지지 않음
+    if (engine == ENGINE_CPQ && !cache_hit) {
+        unsigned char *batch = (unsigned char *) malloc(IO_CHUNK);
+        size_t counts[256] = {0};
+        size_t got;
+        if (batch == NULL) {
+            perror("메모리 할당 실패");
+            exit(EXIT_FAILURE);
+        }
+        while ((got = cpq_dequeue_wait(&cpq, batch, IO_CHUNK)) > 0) {
+            for (size_t k = 0; k < got; k++)
+                counts[batch[k]]++;
+        }
+        for (int v = 0; v < 256; v++)
+            bq_enqueue_n(&bqs[0], (unsigned char) v, counts[v]);
+        free(batch);
+    }
+
+    for (int i = 0; i < n && !cache_hit; ++i) {
         status = pthread_join(thread_ids[i], NULL);
         if (status != 0) {
             perror("pthread_join");
@@ -146,6 +925,25 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    // ENGINE_MERGE: 스레드별 트리를 짝지어 합치는 토너먼트 방식 결합
+    if (engine == ENGINE_MERGE) {
+        int depth = 0;
+        while ((1 << depth) < n)
+            depth++;
+        for (int step = 1; step < n; step *= 2) {
+            for (int i = 0; i + step < n; i += 2 * step) {
+                merge_priority_queue(&pqs[i], &pqs[i + step], depth);
+            }
+        }
+    }
+
+    // ENGINE_BITMAP: 스레드별 개수를 첫 번째 큐로 합침
+    if (engine == ENGINE_BITMAP) {
+        for (int i = 1; i < n; i++) {
+            bq_merge(&bqs[0], &bqs[i]);
+        }
+    }
+
     read_fd = open(string, O_RDONLY | O_BINARY);
     write_fd = open(string2, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
     if (read_fd < 0 || write_fd < 0) {
@@ -153,35 +951,87 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    int i;
-    for (i = 0; i < start_offset; ++i) {
-        if (read(read_fd, &buf, sizeof(buf)) < 0) {
-            if (errno == EINTR) {
-                i--;
-                continue;
-            }
-            perror("read");
-            close(read_fd);
-            exit(EXIT_FAILURE);
-        }
+    // 헤더는 그대로 복사 (RLE8 출력이면 크기 필드를 고쳐 마지막에 기록)
+    unsigned char *header_buf = (unsigned char *) malloc(start_offset > 0 ? (size_t) start_offset : 1);
+    if (header_buf == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(read_fd, header_buf, (size_t) start_offset, 0) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+    if (rle_ptr == NULL && write_full(write_fd, header_buf, (size_t) start_offset) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
 
-        if (write(write_fd, &buf, sizeof(buf)) < 0) {
+    if (engine == ENGINE_MERGE) {
+        // 합쳐진 트리를 중위 순회로 한 번에 펼쳐 기록 (내림차순이면 최대값 finger에서 차례로 꺼냄)
+        out_buf = (unsigned char *) alloc_large((size_t) size);
+        size_t total = 0;
+        if (descending) {
+            while (pqs[0].root != NULL)
+                out_buf[total++] = dequeue_max(&pqs[0]);
+        } else {
+            total = tree_to_array(pqs[0].root, out_buf);
+        }
+        if (emit_bytes(write_fd, rle_ptr, out_buf, total) < 0) {
             perror("write");
             close(write_fd);
             exit(EXIT_FAILURE);
         }
+        free_large(out_buf, (size_t) size);
     }
 
-    while (pq.root != NULL) {
-        buf = dequeue(&pq);
-        if (write(write_fd, &buf, sizeof(buf)) < 0) {
+    // 최소값부터 배치 단위로 꺼내 한 번에 기록
+    write_behind wb = {0, 0};
+    out_buf = (unsigned char *) malloc(IO_CHUNK);
+    if (out_buf == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    while (rle_ptr != NULL && !bq_is_empty(&bqs[0])) {
+        // 값별 개수에서 런을 바로 인코딩
+        unsigned char value;
+        size_t count = bq_dequeue_run(&bqs[0], &value);
+        rle8_put_run(rle_ptr, value, count);
+    }
+    while (!bq_is_empty(&bqs[0])) {
+        size_t got = bq_dequeue_batch(&bqs[0], out_buf, IO_CHUNK);
+        if (write_full(write_fd, out_buf, got) < 0) {
             perror("write");
             close(write_fd);
             exit(EXIT_FAILURE);
         }
+        write_behind_step(write_fd, &wb);
+    }
+    free(out_buf);
+
+    if (rle_ptr != NULL && rle8_finish(rle_ptr, write_fd, header_buf, (size_t) start_offset) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    free(header_buf);
+
+    // 캐시 미스: 값별 개수만 저장, 증분 정렬 상태는 출력 옆에 저장
+    if ((cache_dir != NULL && !cache_hit) || save_state) {
+        size_t counts[256] = {0};
+        for (off_t k = 0; k < size; k++)
+            counts[file_buf[start_offset + k]]++;
+        if (cache_dir != NULL && !cache_hit &&
+            cache_store(cache_dir, key, (size_t) size, counts, cache_limit) < 0)
+            perror("cache");
+        if (save_state && state_save(string2, file_buf, (size_t) start_offset, (size_t) size) < 0)
+            perror("state");
     }
+    free_large(file_buf, (size_t) (start_offset + size));
 
     close(read_fd);
+    drop_output_cache(write_fd);
     close(write_fd);
     pthread_mutex_destroy(&mutex);
     free(thread_ids);
@@ -189,7 +1039,12 @@ int main(int argc, char *argv[]) {
         free(thread_args[i]);
     }
     free(thread_args);
-    free_tree(pq.root);
+    destroy_concurrent_pq(&cpq);
+    for (int i = 0; i < n; i++) {
+        free_tree(pqs[i].root);
+    }
+    free(pqs);
+    free(bqs);
 }
 
 // -----------------------
@@ -201,14 +1056,22 @@ void init_priority_queue(priority_queue *pq) {
     if (pq == NULL)
         return;
     pq->root = NULL;
+    pq->min = NULL;
+    pq->max = NULL;
 }
 
 // 우선순위 큐의 삽입 함수 (enqueue)
+// 중복 값은 오른쪽으로 가므로 새 노드는 같은 값들 중 맨 뒤: 더 작을 때만 min, 같거나 클 때 max
 void enqueue(priority_queue *pq, unsigned char data) {
     if (pq == NULL)
         return;
     pthread_mutex_lock(&mutex);
-    pq->root = insert_node(pq->root, data);
+    Node *created;
+    pq->root = insert_node(pq->root, data, &created);
+    if (pq->min == NULL || data < pq->min->data)
+        pq->min = created;
+    if (pq->max == NULL || data >= pq->max->data)
+        pq->max = created;
     pthread_mutex_unlock(&mutex);
 }
 
@@ -220,18 +1083,51 @@ unsigned char dequeue(priority_queue *pq) {
 
     pthread_mutex_lock(&mutex);
 
-    // 가장 작은 값의 노드를 찾음
-    Node *minNode = find_min(pq->root);
-    unsigned char minValue = minNode->data;
+    // 가장 작은 값의 노드는 finger가 가리킴
+    unsigned char minValue = pq->min->data;
 
-    // 가장 작은 값의 노드를 삭제
-    pq->root = delete_min(pq->root);
+    // 가장 작은 값의 노드를 삭제하고 다음 노드로 finger를 옮김
+    // min과 max가 같은 노드였다면 마지막 원소였음
+    if (pq->min == pq->max)
+        pq->max = NULL;
+    pq->root = delete_min(pq->root, &pq->min);
 
     pthread_mutex_unlock(&mutex);
 
     return minValue;
 }
 
+unsigned char dequeue_max(priority_queue *pq) {
+    if (pq == NULL || pq->root == NULL) {
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&mutex);
+
+    unsigned char maxValue = pq->max->data;
+    if (pq->min == pq->max)
+        pq->min = NULL;
+    pq->root = delete_max(pq->root, &pq->max);
+
+    pthread_mutex_unlock(&mutex);
+
+    return maxValue;
+}
+
+unsigned char peek(priority_queue *pq) {
+    if (pq == NULL || pq->min == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return pq->min->data;
+}
+
+unsigned char peek_max(priority_queue *pq) {
+    if (pq == NULL || pq->max == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    return pq->max->data;
+}
+
 
 // 노드의 높이 반환
 static int get_height(Node *node) {
@@ -313,15 +1209,19 @@ static Node *create_node(unsigned char data) {
 }
 
 // 삽입 연산 (오름차순 정렬)
-static Node *insert_node(Node *node, unsigned char data) {
+static Node *insert_node(Node *node, unsigned char data, Node **created) {
     // 이진 탐색 트리 삽입
-    if (node == NULL)
-        return create_node(data);
+    if (node == NULL) {
+        node = create_node(data);
+        if (created != NULL)
+            *created = node;
+        return node;
+    }
 
     if (data < node->data)
-        node->left = insert_node(node->left, data);
+        node->left = insert_node(node->left, data, created);
     else // 중복된 값은 오른쪽 서브트리에 삽입
-        node->right = insert_node(node->right, data);
+        node->right = insert_node(node->right, data, created);
 
     // 높이 갱신
     update_height(node);
@@ -329,23 +1229,23 @@ static Node *insert_node(Node *node, unsigned char data) {
     // 균형 인수 계산
     int balance = get_balance_factor(node);
 
-    // 균형 조정
+    // 균형 조정 (중복 키가 오른쪽으로 가므로 키 비교 대신 자식의 균형 인수로 판단)
     // LL 회전
-    if (balance > 1 && data < node->left->data)
+    if (balance > 1 && get_balance_factor(node->left) >= 0)
         return rotate_right(node);
 
     // RR 회전
-    if (balance < -1 && data > node->right->data)
+    if (balance < -1 && get_balance_factor(node->right) <= 0)
         return rotate_left(node);
 
     // LR 회전
-    if (balance > 1 && data > node->left->data) {
+    if (balance > 1 && get_balance_factor(node->left) < 0) {
         node->left = rotate_left(node->left);
         return rotate_right(node);
     }
 
     // RL 회전
-    if (balance < -1 && data < node->right->data) {
+    if (balance < -1 && get_balance_factor(node->right) > 0) {
         node->right = rotate_right(node->right);
         return rotate_left(node);
     }
@@ -362,29 +1262,18 @@ static Node *find_min(Node *node) {
     return current;
 }
 
-// 가장 작은 값을 가진 노드 삭제
-static Node *delete_min(Node *node) {
-    if (node == NULL) {
-        // fprintf(stderr, "delete_min: NULL 노드 발견\n");
-        return NULL;
-    }
-
-    if (node->left == NULL) {
-        // printf("delete_min: 삭제할 노드: %d\n", node->data);
-        Node *temp = node->right;
-        free(node);
-        return temp;
+static Node *find_max(Node *node) {
+    Node *current = node;
+    while (current->right != NULL) {
+        current = current->right;
     }
+    return current;
+}
 
-    // printf("delete_min: 현재 노드: %d\n", node->data);
-    node->left = delete_min(node->left);
-
-    // 높이 갱신
+// 높이 갱신 후 균형 조정 (delete_min/delete_max 공통)
+static Node *rebalance(Node *node) {
     update_height(node);
-
-    // 균형 조정
     int balance = get_balance_factor(node);
-    // printf("delete_min: 노드 %d 균형 인수: %d\n", node->data, balance);
 
     if (balance > 1 && get_balance_factor(node->left) >= 0) {
         return rotate_right(node);
@@ -407,6 +1296,56 @@ static Node *delete_min(Node *node) {
     return node;
 }
 
+// 가장 작은 값을 가진 노드 삭제
+// 최소 노드의 오른쪽 자식은 (AVL이므로) 잎 하나뿐이라 그 자식이 다음 노드, 없으면 부모가 다음 노드
+static Node *delete_min(Node *node, Node **next) {
+    if (node == NULL) {
+        // fprintf(stderr, "delete_min: NULL 노드 발견\n");
+        return NULL;
+    }
+
+    if (node->left == NULL) {
+        // printf("delete_min: 삭제할 노드: %d\n", node->data);
+        Node *temp = node->right;
+        if (next != NULL)
+            *next = temp;
+        free(node);
+        return temp;
+    }
+
+    // printf("delete_min: 현재 노드: %d\n", node->data);
+    node->left = delete_min(node->left, next);
+    if (next != NULL && *next == NULL)
+        *next = node;
+
+    return rebalance(node);
+}
+
+// 가장 큰 값을 가진 노드 삭제 (delete_min과 대칭)
+static Node *delete_max(Node *node, Node **prev) {
+    if (node == NULL)
+        return NULL;
+
+    if (node->right == NULL) {
+        Node *temp = node->left;
+        if (prev != NULL)
+            *prev = temp;
+        free(node);
+        return temp;
+    }
+
+    node->right = delete_max(node->right, prev);
+    if (prev != NULL && *prev == NULL)
+        *prev = node;
+
+    return rebalance(node);
+}
+
+static void refresh_fingers(priority_queue *pq) {
+    pq->min = pq->root != NULL ? find_min(pq->root) : NULL;
+    pq->max = pq->root != NULL ? find_max(pq->root) : NULL;
+}
+
 
 // 우선순위 큐의 루트 노드를 반환하는 함수
 Node *get_root(priority_queue *pq) {
@@ -435,38 +1374,589 @@ void free_tree(Node *root) {
     free(root);
 }
 
-void *thread_func(void *arg) {
-    thread_arg *thread_argument = (thread_arg *) arg;
-    int fd;
-    unsigned char buf;
-    ssize_t ret;
+// 정렬된 배열로부터 균형 잡힌 트리를 O(n)에 생성 (기존 원소는 해제)
+void build_priority_queue(priority_queue *pq, const unsigned char *sorted, size_t n) {
+    if (pq == NULL)
+        return;
+    free_tree(pq->root);
+    pq->root = build_balanced(sorted, 0, n);
+    refresh_fingers(pq);
+}
 
-    fd = open(thread_argument->file_name, O_RDONLY | O_BINARY);
-    if (fd < 0) {
-        perror("open");
-        exit(EXIT_FAILURE);
-    }
+// src의 모든 원소를 dst로 옮김, src는 빈 큐가 됨
+void merge_priority_queue(priority_queue *dst, priority_queue *src, int depth) {
+    if (dst == NULL || src == NULL || dst == src)
+        return;
+    dst->root = union_tree(dst->root, src->root, depth);
+    src->root = NULL;
+    refresh_fingers(dst);
+    refresh_fingers(src);
+}
 
-    lseek(fd, thread_argument->offset, SEEK_SET);
-    // pthread_mutex_lock(&mutex);
-    off_t i;
-    for (i = 0; i < thread_argument->quota; ++i) {
-        ret = read(fd, &buf, 1);
-        if (ret < 0) {
-            if (errno == EINTR) {
-                i--;
-                continue;
-            }
+// 중위 순회로 오름차순 복사
+size_t tree_to_array(Node *root, unsigned char *out) {
+    if (root == NULL)
+        return 0;
+    size_t n = tree_to_array(root->left, out);
+    out[n++] = root->data;
+    return n + tree_to_array(root->right, out + n);
+}
+
+// 가운데 원소를 루트로 삼아 재귀적으로 생성 (회전 없음)
+static Node *build_balanced(const unsigned char *sorted, size_t lo, size_t hi) {
+    if (lo >= hi)
+        return NULL;
+    size_t mid = lo + (hi - lo) / 2;
+    Node *node = create_node(sorted[mid]);
+    node->left = build_balanced(sorted, lo, mid);
+    node->right = build_balanced(sorted, mid + 1, hi);
+    update_height(node);
+    return node;
+}
+
+// 세 부분을 하나의 AVL 트리로 결합
+static Node *join_tree(Node *left, Node *key, Node *right) {
+    int hl = get_height(left);
+    int hr = get_height(right);
+
+    if (hl > hr + 1)
+        return join_right(left, key, right);
+    if (hr > hl + 1)
+        return join_left(left, key, right);
+
+    key->left = left;
+    key->right = right;
+    update_height(key);
+    return key;
+}
+
+// left의 오른쪽 경계에서 높이가 right와 비슷한 지점을 찾아 key를 붙임
+static Node *join_right(Node *left, Node *key, Node *right) {
+    Node *c = left->right;
+
+    if (get_height(c) <= get_height(right) + 1) {
+        key->left = c;
+        key->right = right;
+        update_height(key);
+        left->right = key;
+        update_height(left);
+        if (get_height(key) > get_height(left->left) + 1) {
+            left->right = rotate_right(key);
+            update_height(left);
+            return rotate_left(left);
+        }
+        return left;
+    }
+
+    left->right = join_right(c, key, right);
+    update_height(left);
+    if (get_balance_factor(left) < -1)
+        return rotate_left(left);
+    return left;
+}
+
+// join_right의 대칭
+static Node *join_left(Node *left, Node *key, Node *right) {
+    Node *c = right->left;
+
+    if (get_height(c) <= get_height(left) + 1) {
+        key->left = left;
+        key->right = c;
+        update_height(key);
+        right->left = key;
+        update_height(right);
+        if (get_height(key) > get_height(right->right) + 1) {
+            right->left = rotate_left(key);
+            update_height(right);
+            return rotate_right(right);
+        }
+        return right;
+    }
+
+    right->left = join_left(left, key, c);
+    update_height(right);
+    if (get_balance_factor(right) > 1)
+        return rotate_right(right);
+    return right;
+}
+
+// 중위 순서가 오름차순이므로 루트와 key만 비교해 한쪽 서브트리를 통째로 넘김
+static void split_tree(Node *node, unsigned char key, Node **left, Node **right) {
+    if (node == NULL) {
+        *left = NULL;
+        *right = NULL;
+        return;
+    }
+
+    Node *l = node->left;
+    Node *r = node->right;
+    if (node->data >= key) {
+        Node *rl;
+        split_tree(l, key, left, &rl);
+        *right = join_tree(rl, node, r);
+    } else {
+        Node *lr;
+        split_tree(r, key, &lr, right);
+        *left = join_tree(l, node, lr);
+    }
+}
+
+// a의 루트로 b를 분할한 뒤 양쪽을 재귀적으로 합치고 다시 join
+static Node *union_tree(Node *a, Node *b, int depth) {
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+
+    Node *bl;
+    Node *br;
+    Node *al = a->left;
+    Node *ar = a->right;
+    split_tree(b, a->data, &bl, &br);
+
+    Node *l;
+    Node *r;
+    // 작은 서브트리까지 스레드를 만들면 생성 비용이 더 크므로 높이로 제한
+    if (depth > 0 && get_height(a) > UNION_PAR_HEIGHT) {
+        union_task task = {al, bl, NULL, depth - 1};
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, union_task_func, &task) == 0) {
+            r = union_tree(ar, br, depth - 1);
+            pthread_join(tid, NULL);
+            l = task.result;
+        } else {
+            l = union_tree(al, bl, 0);
+            r = union_tree(ar, br, depth - 1);
+        }
+    } else {
+        l = union_tree(al, bl, 0);
+        r = union_tree(ar, br, 0);
+    }
+    return join_tree(l, a, r);
+}
+
+static void *union_task_func(void *arg) {
+    union_task *task = (union_task *) arg;
+    task->result = union_tree(task->a, task->b, task->depth);
+    return NULL;
+}
+
+// 바이트 큐 초기화
+void init_byte_queue(byte_queue *bq) {
+    if (bq == NULL)
+        return;
+    memset(bq, 0, sizeof(*bq));
+}
+
+// 바이트 큐가 비어 있는지 확인
+int bq_is_empty(byte_queue *bq) {
+    return bq->size == 0;
+}
+
+// 값 data를 count개 삽입: 개수가 0에서 바뀔 때만 비트를 켠다
+void bq_enqueue_n(byte_queue *bq, unsigned char data, size_t count) {
+    if (count == 0)
+        return;
+    if (bq->counts[data] == 0)
+        bq->bits[data >> 6] |= (uint64_t) 1 << (data & 63);
+    bq->counts[data] += count;
+    bq->size += count;
+}
+
+void bq_enqueue(byte_queue *bq, unsigned char data) {
+    bq_enqueue_n(bq, data, 1);
+}
+
+// 비트맵에서 가장 작은 값 찾기
+static inline int bq_find_min(const byte_queue *bq) {
+    for (int w = 0; w < 4; w++) {
+        if (bq->bits[w] != 0)
+            return (w << 6) + __builtin_ctzll(bq->bits[w]);
+    }
+    return -1;
+}
+
+unsigned char bq_peek(byte_queue *bq) {
+    if (bq == NULL || bq->size == 0) {
+        // fprintf(stderr, "우선순위 큐가 비어 있습니다.\n");
+        exit(EXIT_FAILURE);
+    }
+    return (unsigned char) bq_find_min(bq);
+}
+
+// 최소값 제거: 개수가 0이 되면 비트를 끈다
+unsigned char bq_dequeue(byte_queue *bq) {
+    unsigned char min_value = bq_peek(bq);
+
+    if (--bq->counts[min_value] == 0)
+        bq->bits[min_value >> 6] &= ~((uint64_t) 1 << (min_value & 63));
+    bq->size--;
+    return min_value;
+}
+
+// 최소값을 모두 꺼냄
+size_t bq_dequeue_run(byte_queue *bq, unsigned char *value) {
+    if (bq->size == 0)
+        return 0;
+    int v = bq_find_min(bq);
+    size_t count = bq->counts[v];
+    bq->counts[v] = 0;
+    bq->bits[v >> 6] &= ~((uint64_t) 1 << (v & 63));
+    bq->size -= count;
+    *value = (unsigned char) v;
+    return count;
+}
+
+// 같은 값은 memset 한 번으로 채운다
+size_t bq_dequeue_batch(byte_queue *bq, unsigned char *out, size_t max) {
+    size_t got = 0;
+
+    while (got < max && bq->size > 0) {
+        int v = bq_find_min(bq);
+        size_t take = bq->counts[v];
+        if (take > max - got)
+            take = max - got;
+        memset(out + got, v, take);
+        got += take;
+        bq->counts[v] -= take;
+        bq->size -= take;
+        if (bq->counts[v] == 0)
+            bq->bits[v >> 6] &= ~((uint64_t) 1 << (v & 63));
+    }
+    return got;
+}
+
+// src의 원소를 dst에 더함
+void bq_merge(byte_queue *dst, const byte_queue *src) {
+    for (int v = 0; v < 256; v++)
+        dst->counts[v] += src->counts[v];
+    for (int w = 0; w < 4; w++)
+        dst->bits[w] |= src->bits[w];
+    dst->size += src->size;
+}
+
+// 동시 우선순위 큐 초기화
+void init_concurrent_pq(concurrent_pq *cpq) {
+    if (cpq == NULL)
+        return;
+    for (int i = 0; i < CPQ_SHARDS; i++) {
+        pthread_mutex_init(&cpq->shards[i].lock, NULL);
+        cpq->shards[i].root = NULL;
+        atomic_init(&cpq->shards[i].count, 0);
+    }
+    atomic_init(&cpq->size, 0);
+    atomic_init(&cpq->producers, 0);
+    atomic_init(&cpq->waiters, 0);
+    pthread_mutex_init(&cpq->wait_lock, NULL);
+    pthread_cond_init(&cpq->nonempty, NULL);
+}
+
+// 동시 우선순위 큐의 모든 노드 해제
+void destroy_concurrent_pq(concurrent_pq *cpq) {
+    if (cpq == NULL)
+        return;
+    for (int i = 0; i < CPQ_SHARDS; i++) {
+        free_tree(cpq->shards[i].root);
+        cpq->shards[i].root = NULL;
+        pthread_mutex_destroy(&cpq->shards[i].lock);
+    }
+    pthread_cond_destroy(&cpq->nonempty);
+    pthread_mutex_destroy(&cpq->wait_lock);
+}
+
+// 기다리는 소비자가 있을 때만 wait_lock을 잡고 깨움
+static void cpq_notify(concurrent_pq *cpq, int all) {
+    if (atomic_load(&cpq->waiters) == 0)
+        return;
+    pthread_mutex_lock(&cpq->wait_lock);
+    if (all)
+        pthread_cond_broadcast(&cpq->nonempty);
+    else
+        pthread_cond_signal(&cpq->nonempty);
+    pthread_mutex_unlock(&cpq->wait_lock);
+}
+
+void cpq_producer_begin(concurrent_pq *cpq) {
+    atomic_fetch_add(&cpq->producers, 1);
+}
+
+void cpq_producer_end(concurrent_pq *cpq) {
+    atomic_fetch_sub(&cpq->producers, 1);
+    cpq_notify(cpq, 1);
+}
+
+// 원소 하나 삽입: 해당 키 범위의 샤드만 잠근다
+void cpq_enqueue(concurrent_pq *cpq, unsigned char data) {
+    pq_shard *shard = &cpq->shards[data >> CPQ_SHARD_SHIFT];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->root = insert_node(shard->root, data, NULL);
+    atomic_fetch_add(&shard->count, 1);
+    pthread_mutex_unlock(&shard->lock);
+    atomic_fetch_add(&cpq->size, 1);
+    cpq_notify(cpq, 0);
+}
+
+// 여러 원소 삽입: 배치를 값별로 센 뒤 샤드마다 잠금을 한 번만 잡고 넣는다
+void cpq_enqueue_batch(concurrent_pq *cpq, const unsigned char *data, size_t n) {
+    size_t counts[256] = {0};
+    size_t shard_counts[CPQ_SHARDS] = {0};
+
+    for (size_t i = 0; i < n; i++)
+        counts[data[i]]++;
+    for (int v = 0; v < 256; v++)
+        shard_counts[v >> CPQ_SHARD_SHIFT] += counts[v];
+
+    for (int s = 0; s < CPQ_SHARDS; s++) {
+        if (shard_counts[s] == 0)
+            continue;
+        pq_shard *shard = &cpq->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (int v = s << CPQ_SHARD_SHIFT; v < (s + 1) << CPQ_SHARD_SHIFT; v++) {
+            for (size_t k = 0; k < counts[v]; k++)
+                shard->root = insert_node(shard->root, (unsigned char) v, NULL);
+        }
+        atomic_fetch_add(&shard->count, shard_counts[s]);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    atomic_fetch_add(&cpq->size, n);
+    cpq_notify(cpq, 0);
+}
+
+// 최소값 하나 꺼내기: 비어 있지 않은 첫 샤드에서 pop
+int cpq_try_dequeue(concurrent_pq *cpq, unsigned char *out) {
+    return cpq_dequeue_batch(cpq, out, 1) == 1;
+}
+
+// 최소값부터 최대 max개를 꺼냄: 빈 샤드는 잠그지 않고 건너뛴다
+size_t cpq_dequeue_batch(concurrent_pq *cpq, unsigned char *out, size_t max) {
+    size_t got = 0;
+
+    for (int s = 0; s < CPQ_SHARDS && got < max; s++) {
+        pq_shard *shard = &cpq->shards[s];
+        if (atomic_load(&shard->count) == 0)
+            continue;
+
+        // 최소 노드는 한 번만 찾고, 이후에는 delete_min이 돌려준 다음 노드를 따라감
+        pthread_mutex_lock(&shard->lock);
+        size_t taken = 0;
+        Node *min = shard->root != NULL ? find_min(shard->root) : NULL;
+        while (min != NULL && got < max) {
+            out[got++] = min->data;
+            shard->root = delete_min(shard->root, &min);
+            taken++;
+        }
+        atomic_fetch_sub(&shard->count, taken);
+        pthread_mutex_unlock(&shard->lock);
+        atomic_fetch_sub(&cpq->size, taken);
+    }
+    return got;
+}
+
+// 생산자가 모두 끝났고 큐가 비었는지 확인
+int cpq_is_drained(concurrent_pq *cpq) {
+    return atomic_load(&cpq->producers) == 0 && atomic_load(&cpq->size) == 0;
+}
+
+size_t cpq_dequeue_wait(concurrent_pq *cpq, unsigned char *out, size_t max) {
+    for (;;) {
+        size_t got = cpq_dequeue_batch(cpq, out, max);
+        if (got > 0)
+            return got;
+
+        pthread_mutex_lock(&cpq->wait_lock);
+        atomic_fetch_add(&cpq->waiters, 1);
+        while (atomic_load(&cpq->size) == 0 && atomic_load(&cpq->producers) > 0)
+            pthread_cond_wait(&cpq->nonempty, &cpq->wait_lock);
+        atomic_fetch_sub(&cpq->waiters, 1);
+        pthread_mutex_unlock(&cpq->wait_lock);
+
+        if (cpq_is_drained(cpq))
+            return 0;
+    }
+}
+
+// LARGE_ALLOC_MIN 이상은 익명 mmap (MAP_HUGETLB -> 일반 페이지 + MADV_HUGEPAGE 순으로 시도),
+// 그보다 작으면 페이지 경계에 맞춘 malloc
+void *alloc_large(size_t size) {
+    void *ptr = NULL;
+
+    if (size >= LARGE_ALLOC_MIN) {
+        size_t len = (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+        if (use_hugetlb) {
+            ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (ptr != MAP_FAILED)
+                return ptr;
+        }
+#endif
+        ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            perror("메모리 할당 실패");
+            exit(EXIT_FAILURE);
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+        return ptr;
+    }
+
+    if (posix_memalign(&ptr, 4096, size > 0 ? size : 1) != 0) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+void free_large(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return;
+    if (size >= LARGE_ALLOC_MIN)
+        munmap(ptr, (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1));
+    else
+        free(ptr);
+}
+
+void write_behind_step(int fd, write_behind *wb) {
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || pos - wb->started < WRITE_BEHIND_WINDOW)
+        return;
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(fd, wb->started, pos - wb->started, SYNC_FILE_RANGE_WRITE);
+    if (wb->started > wb->dropped) {
+        sync_file_range(fd, wb->dropped, wb->started - wb->dropped,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, wb->dropped, wb->started - wb->dropped, POSIX_FADV_DONTNEED);
+        wb->dropped = wb->started;
+    }
+#endif
+    wb->started = pos;
+}
+
+// 길이 0은 파일 끝까지를 뜻함
+void drop_output_cache(int fd) {
+#ifdef SYNC_FILE_RANGE_WRITE
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#else
+    fdatasync(fd);
+#endif
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+// 부분 쓰기와 EINTR을 처리하며 버퍼 전체를 기록
+int write_full(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += ret;
+        len -= (size_t) ret;
+    }
+    return 0;
+}
+
+void *thread_func(void *arg) {
+    thread_arg *thread_argument = (thread_arg *) arg;
+    int fd = -1;
+    int direct = 0;
+    unsigned char *buf;
+    ssize_t ret;
+
+    // O_DIRECT를 지원하지 않는 파일 시스템(tmpfs 등)이면 일반 읽기로 돌아감
+#ifdef O_DIRECT
+    if (use_direct_io) {
+        fd = open(thread_argument->file_name, O_RDONLY | O_BINARY | O_DIRECT);
+        direct = fd >= 0;
+    }
+#endif
+    if (fd < 0)
+        fd = open(thread_argument->file_name, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+
+    if (posix_memalign((void **) &buf, DIRECT_ALIGN, IO_CHUNK) != 0) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    // ENGINE_MERGE, ENGINE_BITMAP: 구간을 값별로 센 뒤 스레드 소유의 큐에 반영
+    size_t counts[256] = {0};
+
+    // O_DIRECT면 구간을 DIRECT_ALIGN 경계로 넓혀 읽고 구간 안쪽만 사용
+    off_t begin = thread_argument->offset;
+    off_t end = begin + thread_argument->quota;
+    off_t pos = direct ? begin & ~(off_t) (DIRECT_ALIGN - 1) : begin;
+    off_t advised = begin;
+    if (!direct)
+        posix_fadvise(fd, begin, thread_argument->quota, POSIX_FADV_SEQUENTIAL);
+
+    // 구간을 청크 단위로 읽어 샤드별로 한 번씩만 잠그고 삽입
+    // 앞쪽은 WILLNEED로 미리 읽히게 하고, 다 쓴 청크는 DONTNEED로 캐시에서 버림
+    off_t done = 0;
+    while (pos < end) {
+        if (!direct && advised < end && advised - pos < READAHEAD_WINDOW) {
+            off_t ahead = end - advised < READAHEAD_WINDOW ? end - advised : READAHEAD_WINDOW;
+            posix_fadvise(fd, advised, ahead, POSIX_FADV_WILLNEED);
+            advised += ahead;
+        }
+        off_t want = end - pos;
+        if (direct)
+            want = (want + DIRECT_ALIGN - 1) & ~(off_t) (DIRECT_ALIGN - 1);
+        if (want > IO_CHUNK)
+            want = IO_CHUNK;
+        ret = pread(fd, buf, (size_t) want, pos);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
             perror("read");
             close(fd);
             exit(EXIT_FAILURE);
         } else if (ret == 0) {
             break;
         }
-        enqueue(thread_argument->pq_ptr, buf);
+        off_t lo = pos < begin ? begin : pos;
+        off_t hi = pos + ret < end ? pos + ret : end;
+        if (hi > lo) {
+            unsigned char *chunk = buf + (lo - pos);
+            size_t len = (size_t) (hi - lo);
+            if (thread_argument->engine == ENGINE_MERGE || thread_argument->engine == ENGINE_BITMAP) {
+                for (size_t k = 0; k < len; k++)
+                    counts[chunk[k]]++;
+            } else {
+                cpq_enqueue_batch(thread_argument->cpq_ptr, chunk, len);
+            }
+            done += hi - lo;
+        }
+        if (!direct)
+            posix_fadvise(fd, pos, ret, POSIX_FADV_DONTNEED);
+        pos += ret;
+        // O_DIRECT의 짧은 읽기는 파일 끝
+        if (direct && ret % DIRECT_ALIGN != 0)
+            break;
+    }
+
+    if (thread_argument->engine == ENGINE_MERGE) {
+        unsigned char *sorted = (unsigned char *) alloc_large((size_t) done);
+        size_t pos = 0;
+        for (int v = 0; v < 256; v++) {
+            memset(sorted + pos, v, counts[v]);
+            pos += counts[v];
+        }
+        build_priority_queue(thread_argument->pq_ptr, sorted, pos);
+        free_large(sorted, (size_t) done);
+    } else if (thread_argument->engine == ENGINE_BITMAP) {
+        for (int v = 0; v < 256; v++)
+            bq_enqueue_n(thread_argument->bq_ptr, (unsigned char) v, counts[v]);
+    } else {
+        cpq_producer_end(thread_argument->cpq_ptr);
     }
-    // pthread_mutex_unlock(&mutex);
 
+    free(buf);
     close(fd);
     return NULL;
 }
@@ -499,3 +1989,1926 @@ off_t find_size(int n, char *file_name) {
 
     return size;
 }
+
+// EINTR을 처리하며 offset부터 len 바이트를 모두 읽음, 파일이 짧으면 -1
+int read_full(int fd, unsigned char *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t ret = pread(fd, buf, len, offset);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        } else if (ret == 0) {
+            return -1;
+        }
+        buf += ret;
+        len -= (size_t) ret;
+        offset += ret;
+    }
+    return 0;
+}
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME64_2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge_round(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+// 32바이트씩 네 갈래로 누적한 뒤 섞는 XXH64 (리틀 엔디언 호스트 기준)
+uint64_t hash_bytes(const unsigned char *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    const unsigned char *end = data + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        uint64_t v2 = seed + XXH_PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME64_1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge_round(h, v1);
+        h = xxh_merge_round(h, v2);
+        h = xxh_merge_round(h, v3);
+        h = xxh_merge_round(h, v4);
+    } else {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += (uint64_t) len;
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t k;
+        memcpy(&k, p, sizeof(k));
+        h ^= (uint64_t) k * XXH_PRIME64_1;
+        h = xxh_rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * XXH_PRIME64_5;
+        h = xxh_rotl(h, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// 정렬 방식을 시드로, 헤더 해시를 다시 시드로 삼아 픽셀 영역을 해시
+uint64_t cache_key(int mode, const unsigned char *header, size_t header_len,
+                   const unsigned char *region, size_t region_len) {
+    uint64_t h = hash_bytes(header, header_len, (uint64_t) mode);
+    return hash_bytes(region, region_len, h);
+}
+
+// 캐시 항목 경로: <dir>/<키 16진수>.psc
+static char *cache_path(const char *dir, uint64_t key) {
+    size_t len = strlen(dir) + 1 + 16 + 4 + 1;
+    char *path = (char *) malloc(len);
+    if (path == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, len, "%s/%016llx.psc", dir, (unsigned long long) key);
+    return path;
+}
+
+// 캐시 항목을 찾아 값별 개수를 bq에 채움, 적중하면 1 반환
+int cache_lookup(const char *dir, uint64_t key, size_t region_len, byte_queue *bq) {
+    char *path = cache_path(dir, key);
+    cache_entry_header header;
+    uint64_t counts[256];
+    int hit = 0;
+
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd >= 0) {
+        if (read_full(fd, (unsigned char *) &header, sizeof(header), 0) == 0 &&
+            memcmp(header.magic, "PSCACHE1", 8) == 0 && header.key == key &&
+            header.region_size == region_len && header.payload_type == CACHE_PAYLOAD_COUNTS &&
+            read_full(fd, (unsigned char *) counts, sizeof(counts), sizeof(header)) == 0) {
+            uint64_t total = 0;
+            for (int v = 0; v < 256; v++)
+                total += counts[v];
+            if (total == region_len) {
+                init_byte_queue(bq);
+                for (int v = 0; v < 256; v++)
+                    bq_enqueue_n(bq, (unsigned char) v, (size_t) counts[v]);
+                hit = 1;
+            }
+        }
+        close(fd);
+        // 수정 시각을 LRU 순서로 사용
+        if (hit)
+            utimensat(AT_FDCWD, path, NULL, 0);
+    }
+
+    free(path);
+    return hit;
+}
+
+// 머리말과 값별 개수를 tmp_path에 쓴 뒤 path로 rename (캐시 항목과 증분 정렬 상태 공통)
+static int publish_counts(const char *path, const char *tmp_path, const void *header, size_t header_len,
+                          const size_t *counts) {
+    uint64_t payload[256];
+    int result = -1;
+
+    for (int v = 0; v < 256; v++)
+        payload[v] = counts[v];
+
+    int fd = open(tmp_path, O_WRONLY | O_BINARY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write_full(fd, (const unsigned char *) header, header_len) == 0 &&
+            write_full(fd, (const unsigned char *) payload, sizeof(payload)) == 0 &&
+            fsync(fd) == 0) {
+            result = 0;
+        }
+        close(fd);
+        if (result == 0 && rename(tmp_path, path) != 0)
+            result = -1;
+        if (result != 0)
+            unlink(tmp_path);
+    }
+    return result;
+}
+
+// 값별 개수를 캐시에 저장, 같은 키를 동시에 쓰더라도 rename은 원자적이다
+int cache_store(const char *dir, uint64_t key, size_t region_len, const size_t *counts,
+                unsigned long long limit) {
+    char *path = cache_path(dir, key);
+    size_t tmp_len = strlen(dir) + 64;
+    char *tmp_path = (char *) malloc(tmp_len);
+
+    if (tmp_path == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(tmp_path, tmp_len, "%s/.tmp-%ld-%016llx", dir, (long) getpid(), (unsigned long long) key);
+
+    cache_entry_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PSCACHE1", 8);
+    header.key = key;
+    header.region_size = region_len;
+    header.payload_type = CACHE_PAYLOAD_COUNTS;
+    int result = publish_counts(path, tmp_path, &header, sizeof(header), counts);
+
+    free(tmp_path);
+    free(path);
+    if (result == 0)
+        cache_evict(dir, limit);
+    return result;
+}
+
+// 출력 파일 옆의 상태 파일 경로: <output>.state (tmp가 1이면 임시 파일 경로)
+static char *state_path(const char *output, int tmp) {
+    size_t len = strlen(output) + 64;
+    char *path = (char *) malloc(len);
+    if (path == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    if (tmp)
+        snprintf(path, len, "%s.state.tmp-%ld", output, (long) getpid());
+    else
+        snprintf(path, len, "%s.state", output);
+    return path;
+}
+
+// 상태 파일을 읽어 입력 키와 영역 크기가 맞으면 머리말과 counts를 채우고 0 반환
+int state_load(const char *output, uint64_t input_key, size_t region_len, sort_state_header *header,
+               size_t *counts) {
+    char *path = state_path(output, 0);
+    uint64_t payload[256];
+    int result = -1;
+
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd >= 0) {
+        if (read_full(fd, (unsigned char *) header, sizeof(*header), 0) == 0 &&
+            memcmp(header->magic, "PSSTATE2", 8) == 0 && header->input_key == input_key &&
+            header->region_size == region_len &&
+            read_full(fd, (unsigned char *) payload, sizeof(payload), sizeof(*header)) == 0) {
+            uint64_t total = 0;
+            for (int v = 0; v < 256; v++)
+                total += payload[v];
+            if (total == region_len) {
+                for (int v = 0; v < 256; v++)
+                    counts[v] = (size_t) payload[v];
+                result = 0;
+            }
+        }
+        close(fd);
+    }
+
+    free(path);
+    return result;
+}
+
+static int state_store(const char *output, uint64_t input_key, size_t region_len, uint64_t output_key,
+                       size_t output_len, const size_t *counts) {
+    char *path = state_path(output, 0);
+    char *tmp_path = state_path(output, 1);
+    sort_state_header header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PSSTATE2", 8);
+    header.input_key = input_key;
+    header.region_size = region_len;
+    header.output_key = output_key;
+    header.output_size = output_len;
+    int result = publish_counts(path, tmp_path, &header, sizeof(header), counts);
+
+    free(tmp_path);
+    free(path);
+    return result;
+}
+
+// 출력은 입력 헤더 뒤에 값별 런이 오름차순으로 이어진 것이므로 개수만으로 다시 만들어 해시
+int state_save(const char *output, const unsigned char *file_buf, size_t header_len, size_t region_len) {
+    size_t counts[256] = {0};
+    for (size_t k = 0; k < region_len; k++)
+        counts[file_buf[header_len + k]]++;
+
+    size_t total_len = header_len + region_len;
+    unsigned char *sorted = (unsigned char *) alloc_large(total_len);
+    memcpy(sorted, file_buf, header_len);
+    size_t pos = header_len;
+    for (int v = 0; v < 256; v++) {
+        memset(sorted + pos, v, counts[v]);
+        pos += counts[v];
+    }
+    uint64_t output_key = hash_bytes(sorted, total_len, 0);
+    free_large(sorted, total_len);
+
+    uint64_t input_key = cache_key(SORT_MODE_GLOBAL, file_buf, header_len, file_buf + header_len, region_len);
+    return state_store(output, input_key, region_len, output_key, total_len, counts);
+}
+
+int state_save_from_input(char *input, char *output) {
+    off_t size = find_size(1, input);
+    off_t start_offset = find_offset(input);
+    size_t total_len = (size_t) (start_offset + size);
+    unsigned char *file_buf = (unsigned char *) alloc_large(total_len);
+
+    int fd = open(input, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(fd, file_buf, total_len, 0) < 0) {
+        perror("read");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    int result = state_save(output, file_buf, (size_t) start_offset, (size_t) size);
+    free_large(file_buf, total_len);
+    return result;
+}
+
+void state_discard(const char *output) {
+    char *path = state_path(output, 0);
+    if (unlink(path) != 0 && errno != ENOENT)
+        perror("state");
+    free(path);
+}
+
+// 16바이트씩 비교해 같은 블록은 건너뛰고, 다른 블록은 바뀐 바이트만 살펴봄
+size_t diff_regions(const unsigned char *old_region, const unsigned char *new_region, size_t len,
+                    int64_t *delta) {
+    size_t changed = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (old_region + i));
+        __m128i b = _mm_loadu_si128((const __m128i *) (new_region + i));
+        unsigned int mask = ~(unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) & 0xFFFF;
+        while (mask != 0) {
+            size_t k = i + (size_t) __builtin_ctz(mask);
+            delta[old_region[k]]--;
+            delta[new_region[k]]++;
+            changed++;
+            mask &= mask - 1;
+        }
+    }
+#else
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, old_region + i, 8);
+        memcpy(&b, new_region + i, 8);
+        if (a == b)
+            continue;
+        for (size_t k = i; k < i + 8; k++) {
+            if (old_region[k] != new_region[k]) {
+                delta[old_region[k]]--;
+                delta[new_region[k]]++;
+                changed++;
+            }
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (old_region[i] != new_region[i]) {
+            delta[old_region[i]]--;
+            delta[new_region[i]]++;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+// 출력에서 값 v의 런은 [prefix(v), prefix(v) + count(v))이므로, 개수가 바뀌면 각 런의 경계만 움직인다.
+// 새 런 중 예전 런과 겹치지 않는 부분만 v로 다시 쓰면 되고, 그 양은 런 경계의 이동량 합이다.
+static int rewrite_range(int fd, unsigned char *out_buf, off_t begin, off_t end, unsigned char value) {
+    if (end <= begin)
+        return 0;
+    memset(out_buf + begin, value, (size_t) (end - begin));
+    if (lseek(fd, begin, SEEK_SET) < 0)
+        return -1;
+    return write_full(fd, out_buf + begin, (size_t) (end - begin));
+}
+
+int run_incremental(char *old_input, char *input, char *output) {
+    off_t size = find_size(1, input);
+    off_t start_offset = find_offset(input);
+    struct stat st;
+
+    if (find_size(1, old_input) != size || find_offset(old_input) != start_offset) {
+        fprintf(stderr, "증분 정렬: 이전 입력과 헤더/픽셀 영역 크기가 달라 전체 정렬합니다.\n");
+        return 0;
+    }
+    if (stat(output, &st) != 0 || st.st_size != start_offset + size) {
+        fprintf(stderr, "증분 정렬: 이전 출력(%s)이 없거나 크기가 달라 전체 정렬합니다.\n", output);
+        return 0;
+    }
+
+    size_t total_len = (size_t) (start_offset + size);
+    unsigned char *old_buf = (unsigned char *) alloc_large(total_len);
+    unsigned char *new_buf = (unsigned char *) alloc_large(total_len);
+    unsigned char *out_buf = (unsigned char *) alloc_large(total_len);
+    int old_fd = open(old_input, O_RDONLY | O_BINARY);
+    int new_fd = open(input, O_RDONLY | O_BINARY);
+    int out_fd = open(output, O_RDWR | O_BINARY);
+    if (old_fd < 0 || new_fd < 0 || out_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(old_fd, old_buf, total_len, 0) < 0 || read_full(new_fd, new_buf, total_len, 0) < 0 ||
+        read_full(out_fd, out_buf, total_len, 0) < 0) {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+    close(old_fd);
+    close(new_fd);
+
+    // 상태가 old_input에서 만들어졌고, 그 뒤로 출력이 다른 실행에 의해 바뀌지 않았는지 확인
+    sort_state_header state;
+    size_t old_counts[256];
+    uint64_t old_key = cache_key(SORT_MODE_GLOBAL, old_buf, (size_t) start_offset,
+                                 old_buf + start_offset, (size_t) size);
+    const char *reason = NULL;
+    if (state_load(output, old_key, (size_t) size, &state, old_counts) < 0)
+        reason = "상태 파일이 없거나 이전 입력과 맞지 않아";
+    else if (state.output_size != total_len || state.output_key != hash_bytes(out_buf, total_len, 0))
+        reason = "출력이 상태 파일을 저장한 뒤 바뀌어";
+    if (reason != NULL) {
+        fprintf(stderr, "증분 정렬: %s 전체 정렬합니다.\n", reason);
+        close(out_fd);
+        free_large(out_buf, total_len);
+        free_large(new_buf, total_len);
+        free_large(old_buf, total_len);
+        return 0;
+    }
+
+    int64_t delta[256] = {0};
+    size_t counts[256];
+    size_t changed = diff_regions(old_buf + start_offset, new_buf + start_offset, (size_t) size, delta);
+    for (int v = 0; v < 256; v++)
+        counts[v] = (size_t) ((int64_t) old_counts[v] + delta[v]);
+
+    // 헤더가 바뀌었으면 헤더도 다시 씀
+    size_t written = 0;
+    if (memcmp(out_buf, new_buf, (size_t) start_offset) != 0) {
+        memcpy(out_buf, new_buf, (size_t) start_offset);
+        if (lseek(out_fd, 0, SEEK_SET) < 0 || write_full(out_fd, out_buf, (size_t) start_offset) < 0) {
+            perror("write");
+            close(out_fd);
+            exit(EXIT_FAILURE);
+        }
+        written += (size_t) start_offset;
+    }
+
+    // 새 런 [new_pos, new_end) 중 예전 런 [old_pos, old_end) 앞뒤로 삐져나온 부분만 기록
+    off_t old_pos = start_offset;
+    off_t new_pos = start_offset;
+    for (int v = 0; v < 256; v++) {
+        off_t old_end = old_pos + (off_t) old_counts[v];
+        off_t new_end = new_pos + (off_t) counts[v];
+        off_t head_end = new_end < old_pos ? new_end : old_pos;
+        off_t tail_begin = new_pos > old_end ? new_pos : old_end;
+        if (rewrite_range(out_fd, out_buf, new_pos, head_end, (unsigned char) v) < 0 ||
+            rewrite_range(out_fd, out_buf, tail_begin, new_end, (unsigned char) v) < 0) {
+            perror("write");
+            close(out_fd);
+            exit(EXIT_FAILURE);
+        }
+        if (head_end > new_pos)
+            written += (size_t) (head_end - new_pos);
+        if (new_end > tail_begin)
+            written += (size_t) (new_end - tail_begin);
+        old_pos = old_end;
+        new_pos = new_end;
+    }
+    drop_output_cache(out_fd);
+    close(out_fd);
+
+    uint64_t new_key = cache_key(SORT_MODE_GLOBAL, new_buf, (size_t) start_offset,
+                                 new_buf + start_offset, (size_t) size);
+    if (state_store(output, new_key, (size_t) size, hash_bytes(out_buf, total_len, 0), total_len, counts) < 0)
+        perror("state");
+    fprintf(stderr, "증분 정렬: 바뀐 바이트 %zu개, 다시 쓴 출력 %zu바이트\n", changed, written);
+
+    free_large(out_buf, total_len);
+    free_large(new_buf, total_len);
+    free_large(old_buf, total_len);
+    return 1;
+}
+
+static int compare_cache_file(const void *a, const void *b) {
+    const cache_file *x = (const cache_file *) a;
+    const cache_file *y = (const cache_file *) b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+// 캐시 디렉터리 크기가 limit 이하가 될 때까지 오래 쓰지 않은 항목부터 삭제
+void cache_evict(const char *dir, unsigned long long limit) {
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    cache_file *files = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
+    unsigned long long total = 0;
+
+    if (d == NULL)
+        return;
+
+    while ((entry = readdir(d)) != NULL) {
+        size_t name_len = strlen(entry->d_name);
+        if (name_len < 4 || strcmp(entry->d_name + name_len - 4, ".psc") != 0)
+            continue;
+
+        size_t path_len = strlen(dir) + 1 + name_len + 1;
+        char *path = (char *) malloc(path_len);
+        struct stat st;
+        if (path == NULL) {
+            perror("메모리 할당 실패");
+            exit(EXIT_FAILURE);
+        }
+        snprintf(path, path_len, "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) != 0) {
+            free(path);
+            continue;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            files = (cache_file *) realloc(files, capacity * sizeof(cache_file));
+            if (files == NULL) {
+                perror("메모리 할당 실패");
+                exit(EXIT_FAILURE);
+            }
+        }
+        files[count].path = path;
+        files[count].size = st.st_size;
+        files[count].mtime = st.st_mtime;
+        total += (unsigned long long) st.st_size;
+        count++;
+    }
+    closedir(d);
+
+    qsort(files, count, sizeof(cache_file), compare_cache_file);
+    for (size_t i = 0; i < count; i++) {
+        if (total > limit && unlink(files[i].path) == 0)
+            total -= (unsigned long long) files[i].size;
+        free(files[i].path);
+    }
+    free(files);
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+// BITMAPFILEHEADER(14) + BITMAPINFOHEADER 앞부분(40)을 해석
+int find_bmp_info(char *file_name, bmp_info *info) {
+    unsigned char header[54];
+    int fd = open(file_name, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    int ret = read_full(fd, header, sizeof(header), 0);
+    close(fd);
+    if (ret < 0 || header[0] != 'B' || header[1] != 'M')
+        return -1;
+
+    info->offset = (off_t) read_le32(header + 10);
+    info->width = (int32_t) read_le32(header + 18);
+    info->height = (int32_t) read_le32(header + 22);
+    info->bpp = (uint16_t) (header[28] | (header[29] << 8));
+    info->compression = read_le32(header + 30);
+    if (info->width <= 0 || info->height == 0 || info->bpp == 0)
+        return -1;
+
+    info->rows = (size_t) (info->height < 0 ? -(int64_t) info->height : info->height);
+    info->row_bytes = ((size_t) info->width * info->bpp + 7) / 8;
+    info->stride = (((size_t) info->width * info->bpp + 31) / 32) * 4;
+    return 0;
+}
+
+// 작은 구간은 삽입 정렬, 큰 구간은 L1에 들어가는 256칸 히스토그램으로 정렬
+void sort_bytes_small(unsigned char *data, size_t n) {
+    if (n <= SMALL_SORT_MAX) {
+        for (size_t i = 1; i < n; i++) {
+            unsigned char v = data[i];
+            size_t j = i;
+            while (j > 0 && data[j - 1] > v) {
+                data[j] = data[j - 1];
+                j--;
+            }
+            data[j] = v;
+        }
+        return;
+    }
+
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < n; i++)
+        counts[data[i]]++;
+    size_t pos = 0;
+    for (int v = 0; v < 256; v++) {
+        memset(data + pos, v, counts[v]);
+        pos += counts[v];
+    }
+}
+
+// 자기 band의 행을 직접 읽어 행 또는 타일마다 정렬
+void *band_thread_func(void *arg) {
+    band_arg *band = (band_arg *) arg;
+    const bmp_info *info = band->info;
+    unsigned char *base = band->region + band->row_begin * info->stride;
+    size_t len = (band->row_end - band->row_begin) * info->stride;
+
+    if (len == 0)
+        return NULL;
+
+    int fd = open(band->file_name, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(fd, base, len, info->offset + (off_t) (band->row_begin * info->stride)) < 0) {
+        perror("read");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (band->mode == SORT_MODE_ROWS) {
+        // 패딩 바이트는 건드리지 않음
+        for (size_t r = band->row_begin; r < band->row_end; r++)
+            sort_bytes_small(band->region + r * info->stride, info->row_bytes);
+        return NULL;
+    }
+
+    // 타일 하나를 지역 버퍼에 모아 정렬한 뒤 같은 행 우선 순서로 되돌려 씀
+    size_t bytes_per_pixel = info->bpp / 8;
+    size_t tile_row_bytes = (size_t) band->tile_w * bytes_per_pixel;
+    unsigned char *tile = (unsigned char *) malloc(tile_row_bytes * band->tile_h);
+    if (tile == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t r0 = band->row_begin; r0 < band->row_end; r0 += band->tile_h) {
+        size_t r1 = r0 + band->tile_h < band->row_end ? r0 + band->tile_h : band->row_end;
+        for (size_t x0 = 0; x0 < info->row_bytes; x0 += tile_row_bytes) {
+            size_t w = x0 + tile_row_bytes < info->row_bytes ? tile_row_bytes : info->row_bytes - x0;
+            size_t k = 0;
+            for (size_t r = r0; r < r1; r++, k += w)
+                memcpy(tile + k, band->region + r * info->stride + x0, w);
+            sort_bytes_small(tile, k);
+            k = 0;
+            for (size_t r = r0; r < r1; r++, k += w)
+                memcpy(band->region + r * info->stride + x0, tile + k, w);
+        }
+    }
+
+    free(tile);
+    return NULL;
+}
+
+// 행 또는 타일 단위 정렬: 전역 우선순위 큐 없이 band마다 독립적으로 처리
+int run_band_sort(char *input, char *output, int mode, int tile_w, int tile_h, int n) {
+    bmp_info info;
+    if (find_bmp_info(input, &info) < 0) {
+        fprintf(stderr, "BMP 헤더를 해석할 수 없습니다: %s\n", input);
+        return -1;
+    }
+    if (info.compression != 0 && info.compression != 3) {
+        fprintf(stderr, "압축된 BMP는 행/타일 정렬을 지원하지 않습니다.\n");
+        return -1;
+    }
+    if (mode == SORT_MODE_TILES && (info.bpp % 8 != 0 || tile_w < 1 || tile_h < 1)) {
+        fprintf(stderr, "타일 정렬은 8비트 배수의 픽셀과 양수 타일 크기가 필요합니다.\n");
+        return -1;
+    }
+
+    off_t size = find_size(n, input);
+    if ((off_t) (info.rows * info.stride) > size) {
+        fprintf(stderr, "픽셀 영역이 헤더에 적힌 크기보다 작습니다.\n");
+        return -1;
+    }
+
+    // 각 band의 페이지는 그 band를 읽어 들이는 작업 스레드가 처음 건드림
+    unsigned char *region = (unsigned char *) alloc_large((size_t) size);
+    unsigned char *header = (unsigned char *) malloc(info.offset > 0 ? (size_t) info.offset : 1);
+    band_arg *bands = (band_arg *) malloc(n * sizeof(band_arg));
+    pthread_t *thread_ids = (pthread_t *) malloc(n * sizeof(pthread_t));
+    if (header == NULL || bands == NULL || thread_ids == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    // 타일 모드에서는 band 경계가 타일 경계와 맞도록 tile_h 행 단위로 나눔
+    size_t unit = mode == SORT_MODE_TILES ? (size_t) tile_h : 1;
+    size_t units = (info.rows + unit - 1) / unit;
+    for (int i = 0; i < n; i++) {
+        size_t begin = units * i / n * unit;
+        size_t end = units * (i + 1) / n * unit;
+        bands[i].file_name = input;
+        bands[i].info = &info;
+        bands[i].region = region;
+        bands[i].mode = mode;
+        bands[i].tile_w = tile_w;
+        bands[i].tile_h = tile_h;
+        bands[i].row_begin = begin < info.rows ? begin : info.rows;
+        bands[i].row_end = end < info.rows ? end : info.rows;
+    }
+
+    for (int i = 0; i < n; i++) {
+        int status = pthread_create(&thread_ids[i], NULL, band_thread_func, &bands[i]);
+        if (status != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int read_fd = open(input, O_RDONLY | O_BINARY);
+    if (read_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    // 헤더와, 행 뒤에 남는 바이트(있다면)는 그대로 복사
+    size_t pixel_bytes = info.rows * info.stride;
+    if (read_full(read_fd, header, (size_t) info.offset, 0) < 0 ||
+        read_full(read_fd, region + pixel_bytes, (size_t) size - pixel_bytes,
+                  info.offset + (off_t) pixel_bytes) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(read_fd);
+
+    for (int i = 0; i < n; i++) {
+        int status = pthread_join(thread_ids[i], NULL);
+        if (status != 0) {
+            perror("pthread_join");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int write_fd = open(output, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
+    if (write_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(write_fd, header, (size_t) info.offset) < 0 ||
+        write_full(write_fd, region, (size_t) size) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(write_fd);
+    close(write_fd);
+
+    free(thread_ids);
+    free(bands);
+    free(header);
+    free_large(region, (size_t) size);
+    return 0;
+}
+
+// 1단계: 구간을 읽어 들이고 값별 개수를 셈
+// 픽셀 구간과 같은 범위의 perm 페이지도 이 스레드가 먼저 건드려 같은 노드에 놓이게 함
+void *argsort_count_func(void *arg) {
+    argsort_arg *task = (argsort_arg *) arg;
+    if (read_full(task->fd, task->region + task->begin, task->end - task->begin,
+                  task->offset + (off_t) task->begin) < 0) {
+        perror("read");
+        exit(EXIT_FAILURE);
+    }
+    memset((unsigned char *) task->perm + task->begin * task->index_bytes, 0,
+           (task->end - task->begin) * task->index_bytes);
+    memset(task->counts, 0, sizeof(task->counts));
+    for (size_t i = task->begin; i < task->end; i++)
+        task->counts[task->region[i]]++;
+    return NULL;
+}
+
+// 2단계: 구간을 앞에서부터 훑으며 값별 위치에 원래 인덱스를 기록 (안정성 유지)
+void *argsort_scatter_func(void *arg) {
+    argsort_arg *task = (argsort_arg *) arg;
+    if (task->index_bytes == 4) {
+        uint32_t *perm = (uint32_t *) task->perm;
+        for (size_t i = task->begin; i < task->end; i++)
+            perm[task->counts[task->region[i]]++] = (uint32_t) i;
+    } else {
+        uint64_t *perm = (uint64_t *) task->perm;
+        for (size_t i = task->begin; i < task->end; i++)
+            perm[task->counts[task->region[i]]++] = (uint64_t) i;
+    }
+    return NULL;
+}
+
+// 스레드별 히스토그램 -> 값 우선, 스레드 다음 순서의 누적합 -> 동시 scatter
+int run_argsort(char *input, char *output, char *perm_file, int index_bytes, int n) {
+    off_t size = find_size(n, input);
+    off_t start_offset = find_offset(input);
+    size_t count = (size_t) size;
+
+    if (index_bytes == 0)
+        index_bytes = count <= UINT32_MAX ? 4 : 8;
+    if (index_bytes == 4 && count > UINT32_MAX) {
+        fprintf(stderr, "원소가 너무 많아 32비트 인덱스를 쓸 수 없습니다.\n");
+        return -1;
+    }
+
+    // 헤더만 여기서 읽고, 픽셀 영역과 perm은 각 작업 스레드가 처음 건드림
+    unsigned char *file_buf = (unsigned char *) alloc_large((size_t) (start_offset + size));
+    void *perm = alloc_large(count * index_bytes);
+    argsort_arg *tasks = (argsort_arg *) malloc(n * sizeof(argsort_arg));
+    pthread_t *thread_ids = (pthread_t *) malloc(n * sizeof(pthread_t));
+    if (tasks == NULL || thread_ids == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    int read_fd = open(input, O_RDONLY | O_BINARY);
+    if (read_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(read_fd, file_buf, (size_t) start_offset, 0) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    unsigned char *region = file_buf + start_offset;
+    for (int i = 0; i < n; i++) {
+        tasks[i].region = region;
+        tasks[i].fd = read_fd;
+        tasks[i].offset = start_offset;
+        tasks[i].begin = count * i / n;
+        tasks[i].end = count * (i + 1) / n;
+        tasks[i].perm = perm;
+        tasks[i].index_bytes = index_bytes;
+    }
+
+    for (int phase = 0; phase < 2; phase++) {
+        void *(*func)(void *) = phase == 0 ? argsort_count_func : argsort_scatter_func;
+        for (int i = 0; i < n; i++) {
+            if (pthread_create(&thread_ids[i], NULL, func, &tasks[i]) != 0) {
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (pthread_join(thread_ids[i], NULL) != 0) {
+                perror("pthread_join");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // 값 v의 스레드 t 시작 위치 = (v보다 작은 값의 총 개수) + (앞선 스레드의 v 개수)
+        if (phase == 0) {
+            close(read_fd);
+            size_t pos = 0;
+            for (int v = 0; v < 256; v++) {
+                for (int i = 0; i < n; i++) {
+                    size_t c = tasks[i].counts[v];
+                    tasks[i].counts[v] = pos;
+                    pos += c;
+                }
+            }
+        }
+    }
+
+    perm_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PSPERM01", 8);
+    header.index_bytes = (uint32_t) index_bytes;
+    header.count = count;
+
+    int perm_fd = open(perm_file, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0644);
+    if (perm_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(perm_fd, (const unsigned char *) &header, sizeof(header)) < 0 ||
+        write_full(perm_fd, (const unsigned char *) perm, count * index_bytes) < 0) {
+        perror("write");
+        close(perm_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(perm_fd);
+    close(perm_fd);
+
+    // 정렬된 이미지도 함께 기록 (순열을 그대로 적용)
+    unsigned char *sorted = (unsigned char *) alloc_large(count);
+    for (size_t i = 0; i < count; i++)
+        sorted[i] = region[index_bytes == 4 ? ((uint32_t *) perm)[i] : ((uint64_t *) perm)[i]];
+
+    int write_fd = open(output, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
+    if (write_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(write_fd, file_buf, (size_t) start_offset) < 0 ||
+        write_full(write_fd, sorted, count) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(write_fd);
+    close(write_fd);
+
+    free_large(sorted, count);
+    free(thread_ids);
+    free(tasks);
+    free_large(perm, count * index_bytes);
+    free_large(file_buf, (size_t) (start_offset + size));
+    return 0;
+}
+
+// 원소 크기 = 픽셀 영역 크기 / 순열 길이, 따라서 다른 비트 깊이의 동반 이미지에도 적용 가능
+int run_apply_permutation(char *input, char *output, char *perm_file) {
+    perm_header header;
+    int perm_fd = open(perm_file, O_RDONLY | O_BINARY);
+    if (perm_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(perm_fd, (unsigned char *) &header, sizeof(header), 0) < 0 ||
+        memcmp(header.magic, "PSPERM01", 8) != 0 ||
+        (header.index_bytes != 4 && header.index_bytes != 8)) {
+        fprintf(stderr, "순열 파일 형식이 올바르지 않습니다: %s\n", perm_file);
+        close(perm_fd);
+        return -1;
+    }
+
+    off_t size = find_size(1, input);
+    off_t start_offset = find_offset(input);
+    size_t count = (size_t) header.count;
+    if (count == 0 || (size_t) size % count != 0) {
+        fprintf(stderr, "픽셀 영역 크기(%lld)가 순열 길이(%zu)의 배수가 아닙니다.\n", (long long) size, count);
+        close(perm_fd);
+        return -1;
+    }
+    size_t elem = (size_t) size / count;
+
+    void *perm = alloc_large(count * header.index_bytes);
+    unsigned char *file_buf = (unsigned char *) alloc_large((size_t) (start_offset + size));
+    unsigned char *out = (unsigned char *) alloc_large((size_t) size);
+    if (read_full(perm_fd, (unsigned char *) perm, count * header.index_bytes, sizeof(header)) < 0) {
+        perror("read");
+        close(perm_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(perm_fd);
+
+    int read_fd = open(input, O_RDONLY | O_BINARY);
+    if (read_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(read_fd, file_buf, (size_t) (start_offset + size), 0) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(read_fd);
+
+    const unsigned char *region = file_buf + start_offset;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t src = header.index_bytes == 4 ? ((uint32_t *) perm)[i] : ((uint64_t *) perm)[i];
+        if (src >= count) {
+            fprintf(stderr, "순열 인덱스가 범위를 벗어났습니다: %llu\n", (unsigned long long) src);
+            free_large(out, (size_t) size);
+            free_large(file_buf, (size_t) (start_offset + size));
+            free_large(perm, count * header.index_bytes);
+            return -1;
+        }
+        memcpy(out + i * elem, region + src * elem, elem);
+    }
+
+    int write_fd = open(output, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
+    if (write_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(write_fd, file_buf, (size_t) start_offset) < 0 ||
+        write_full(write_fd, out, (size_t) size) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(write_fd);
+    close(write_fd);
+
+    free_large(out, (size_t) size);
+    free_large(file_buf, (size_t) (start_offset + size));
+    free_large(perm, count * header.index_bytes);
+    return 0;
+}
+
+static void rle8_push(rle8_writer *w, unsigned char a, unsigned char b) {
+    if (w->len + 2 > w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 4096;
+        w->buf = (unsigned char *) realloc(w->buf, w->cap);
+        if (w->buf == NULL) {
+            perror("메모리 할당 실패");
+            exit(EXIT_FAILURE);
+        }
+    }
+    w->buf[w->len++] = a;
+    w->buf[w->len++] = b;
+}
+
+// RLE8 인코더 초기화
+void rle8_init(rle8_writer *w, const bmp_info *info) {
+    memset(w, 0, sizeof(*w));
+    w->width = (size_t) info->width;
+    w->stride = info->stride;
+    w->rows = info->rows;
+    w->pending_value = -1;
+}
+
+// 런을 비압축 출력 위치에 맞춰 행별로 인코딩: 패딩과 마지막 행 이후의 바이트는 버림
+static void rle8_encode_run(rle8_writer *w, unsigned char value, size_t count) {
+    size_t limit = w->stride * w->rows;
+
+    while (count > 0 && w->pos < limit) {
+        size_t col = w->pos % w->stride;
+        if (col >= w->width) {
+            size_t skip = w->stride - col < count ? w->stride - col : count;
+            w->pos += skip;
+            count -= skip;
+            continue;
+        }
+
+        size_t take = w->width - col < count ? w->width - col : count;
+        for (size_t left = take; left > 0;) {
+            size_t k = left < 255 ? left : 255;
+            rle8_push(w, (unsigned char) k, value);
+            left -= k;
+        }
+        w->pos += take;
+        count -= take;
+
+        // 행의 픽셀을 다 채우면 행 끝(00 00), 마지막 행이면 비트맵 끝(00 01)
+        if (col + take == w->width)
+            rle8_push(w, 0, (w->pos - 1) / w->stride + 1 >= w->rows ? 1 : 0);
+    }
+}
+
+// 같은 값의 런은 합쳐서 최대 255 길이의 조각으로 인코딩
+void rle8_put_run(rle8_writer *w, unsigned char value, size_t count) {
+    if (count == 0)
+        return;
+    if (w->pending_value == value) {
+        w->pending_count += count;
+        return;
+    }
+    if (w->pending_value >= 0)
+        rle8_encode_run(w, (unsigned char) w->pending_value, w->pending_count);
+    w->pending_value = value;
+    w->pending_count = count;
+}
+
+void rle8_put_bytes(rle8_writer *w, const unsigned char *data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        size_t j = i + 1;
+        while (j < len && data[j] == data[i])
+            j++;
+        rle8_put_run(w, data[i], j - i);
+        i = j;
+    }
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char) v;
+    p[1] = (unsigned char) (v >> 8);
+    p[2] = (unsigned char) (v >> 16);
+    p[3] = (unsigned char) (v >> 24);
+}
+
+// bfSize, biCompression(BI_RLE8 = 1), biSizeImage를 고쳐 기록
+int rle8_finish(rle8_writer *w, int fd, unsigned char *header, size_t header_len) {
+    if (w->pending_value >= 0)
+        rle8_encode_run(w, (unsigned char) w->pending_value, w->pending_count);
+    w->pending_value = -1;
+    if (w->len < 2 || w->buf[w->len - 2] != 0 || w->buf[w->len - 1] != 1)
+        rle8_push(w, 0, 1);
+
+    put_le32(header + 2, (uint32_t) (header_len + w->len));
+    put_le32(header + 30, 1);
+    put_le32(header + 34, (uint32_t) w->len);
+
+    int ret = 0;
+    if (write_full(fd, header, header_len) < 0 || write_full(fd, w->buf, w->len) < 0)
+        ret = -1;
+    free(w->buf);
+    w->buf = NULL;
+    w->len = w->cap = 0;
+    return ret;
+}
+
+// 정렬된 바이트를 rle가 있으면 RLE8로, 없으면 그대로 기록
+int emit_bytes(int fd, rle8_writer *rle, const unsigned char *data, size_t len) {
+    if (rle != NULL) {
+        rle8_put_bytes(rle, data, len);
+        return 0;
+    }
+    return write_full(fd, data, len);
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return (x > y) - (x < y);
+}
+
+static inline uint32_t load_key(const unsigned char *p, int key_bytes) {
+    if (key_bytes == 1)
+        return *p;
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// 블록 안의 인접 쌍과 이전 블록 끝-다음 블록 시작 쌍을 함께 센다
+void sample_region(char *file_name, off_t offset, off_t size, int key_bytes, sample_stats *stats) {
+    unsigned char *block = (unsigned char *) malloc(SAMPLE_BLOCK_SIZE);
+    uint32_t *keys = (uint32_t *) malloc((size_t) SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE / key_bytes * sizeof(uint32_t));
+    size_t nkeys = 0;
+    int has_prev = 0;
+    uint32_t prev = 0;
+
+    if (block == NULL || keys == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->size = size;
+    stats->key_bytes = key_bytes;
+
+    int fd = open(file_name, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+
+    // 영역이 작으면 블록이 겹치지 않도록 처음부터 끝까지 이어서 읽음, 블록 시작은 키 경계에 맞춤
+    off_t keys_total = size / key_bytes;
+    off_t keys_per_block = SAMPLE_BLOCK_SIZE / key_bytes;
+    int blocks = keys_total <= SAMPLE_BLOCKS * keys_per_block
+                     ? (int) ((keys_total + keys_per_block - 1) / keys_per_block)
+                     : SAMPLE_BLOCKS;
+    for (int b = 0; b < blocks; b++) {
+        off_t first = keys_total <= SAMPLE_BLOCKS * keys_per_block
+                          ? (off_t) b * keys_per_block
+                          : (keys_total - keys_per_block) * b / (SAMPLE_BLOCKS - 1);
+        size_t len = keys_total - first < keys_per_block ? (size_t) (keys_total - first) : (size_t) keys_per_block;
+        if (read_full(fd, block, len * key_bytes, offset + first * key_bytes) < 0) {
+            perror("read");
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t i = 0; i < len; i++) {
+            uint32_t v = load_key(block + i * key_bytes, key_bytes);
+            keys[nkeys++] = v;
+            if (has_prev) {
+                stats->pairs++;
+                if (prev <= v)
+                    stats->ascending++;
+                if (prev >= v)
+                    stats->descending++;
+                if (prev > v)
+                    stats->runs++;
+            }
+            prev = v;
+            has_prev = 1;
+        }
+        stats->sampled += len * key_bytes;
+    }
+    close(fd);
+    free(block);
+
+    if (nkeys > 0)
+        stats->runs++;
+
+    // 표본 키를 정렬해 서로 다른 값을 셈
+    qsort(keys, nkeys, sizeof(uint32_t), compare_u32);
+    for (size_t i = 0; i < nkeys; i++) {
+        if (i == 0 || keys[i] != keys[i - 1])
+            stats->distinct++;
+    }
+    free(keys);
+}
+
+// 표본이 완전히 단조일 때만 복사/뒤집기를 고르고 (전체 검증은 run_copy_through에서),
+// 그 밖의 1바이트 키는 계수 정렬이 항상 O(n)이므로 bitmap 엔진을,
+// 4바이트 키는 비트닉 런 생성 후 병합하는 wide 엔진을 고른다
+sort_engine choose_engine(const sample_stats *stats, char *reason, size_t reason_len) {
+    double asc = stats->pairs ? 100.0 * stats->ascending / stats->pairs : 100.0;
+    double desc = stats->pairs ? 100.0 * stats->descending / stats->pairs : 100.0;
+    sort_engine engine;
+    const char *why;
+
+    if (stats->ascending == stats->pairs) {
+        engine = ENGINE_COPY;
+        why = "표본이 이미 오름차순";
+    } else if (stats->descending == stats->pairs) {
+        engine = ENGINE_REVERSE;
+        why = "표본이 내림차순";
+    } else if (stats->key_bytes == 4) {
+        engine = ENGINE_WIDE;
+        why = "4바이트 키는 비트닉 런 생성 후 병합";
+    } else {
+        engine = ENGINE_BITMAP;
+        why = "1바이트 키는 계수 정렬";
+    }
+
+    snprintf(reason, reason_len,
+             "%s, 크기 %lld바이트, 표본 %zu바이트, 오름차순 쌍 %.1f%%, 내림차순 쌍 %.1f%%, 런 %zu개, "
+             "서로 다른 값 %zu개",
+             why, (long long) stats->size, stats->sampled, asc, desc, stats->runs, stats->distinct);
+    return engine;
+}
+
+// 표본만으로는 단조임을 보장할 수 없으므로 출력 전에 영역 전체를 확인
+int run_copy_through(char *input, char *output, int key_bytes, int reverse) {
+    off_t size = find_size(1, input);
+    off_t start_offset = find_offset(input);
+    unsigned char *file_buf = (unsigned char *) alloc_large((size_t) (start_offset + size));
+
+    int read_fd = open(input, O_RDONLY | O_BINARY);
+    if (read_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(read_fd, file_buf, (size_t) (start_offset + size), 0) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(read_fd);
+
+    // 키 크기로 나누어떨어지지 않는 꼬리 바이트는 그대로 둠
+    unsigned char *region = file_buf + start_offset;
+    off_t count = size / key_bytes;
+    for (off_t i = 1; i < count; i++) {
+        uint32_t a = load_key(region + (i - 1) * key_bytes, key_bytes);
+        uint32_t b = load_key(region + i * key_bytes, key_bytes);
+        if (reverse ? a < b : a > b) {
+            free_large(file_buf, (size_t) (start_offset + size));
+            return 0;
+        }
+    }
+
+    if (reverse) {
+        unsigned char t[4];
+        for (off_t i = 0, j = count - 1; i < j; i++, j--) {
+            memcpy(t, region + i * key_bytes, key_bytes);
+            memcpy(region + i * key_bytes, region + j * key_bytes, key_bytes);
+            memcpy(region + j * key_bytes, t, key_bytes);
+        }
+    }
+
+    int write_fd = open(output, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
+    if (write_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(write_fd, file_buf, (size_t) (start_offset + size)) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(write_fd);
+    close(write_fd);
+    free_large(file_buf, (size_t) (start_offset + size));
+    return 1;
+}
+
+// 블록 정렬과 두 런 병합 커널 (init_simd_dispatch가 CPU에 맞게 고름)
+typedef void (*block_sort_fn)(uint32_t *keys, size_t n);
+typedef void (*merge_fn)(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out);
+
+// 스칼라 블록 정렬: WIDE_BLOCK 이하 크기에 대한 삽입 정렬
+static void sort_block_scalar(uint32_t *keys, size_t n) {
+    for (size_t i = 1; i < n; i++) {
+        uint32_t v = keys[i];
+        size_t j = i;
+        while (j > 0 && keys[j - 1] > v) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = v;
+    }
+}
+
+// 스칼라 병합 (같은 키는 a 쪽이 먼저)
+static void merge_u32_scalar(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb)
+        *out++ = b[j] < a[i] ? b[j++] : a[i++];
+    while (i < na)
+        *out++ = a[i++];
+    while (j < nb)
+        *out++ = b[j++];
+}
+
+static block_sort_fn sort_block_u32 = sort_block_scalar;
+static merge_fn merge_u32 = merge_u32_scalar;
+
+#ifdef HAVE_X86_SIMD
+
+// 8레인 비트닉 수열을 오름차순으로 정리 (거리 4, 2, 1 비교-교환)
+__attribute__((target("avx2")))
+static inline __m256i bitonic_clean8(__m256i x) {
+    __m256i t = _mm256_permute2x128_si256(x, x, 0x01);
+    x = _mm256_blend_epi32(_mm256_min_epu32(x, t), _mm256_max_epu32(x, t), 0xF0);
+    t = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+    x = _mm256_blend_epi32(_mm256_min_epu32(x, t), _mm256_max_epu32(x, t), 0xCC);
+    t = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+    x = _mm256_blend_epi32(_mm256_min_epu32(x, t), _mm256_max_epu32(x, t), 0xAA);
+    return x;
+}
+
+// 정렬된 두 레지스터를 병합해 작은 8개는 lo, 큰 8개는 hi로
+__attribute__((target("avx2")))
+static inline void bitonic_merge8x8(__m256i a, __m256i b, __m256i *lo, __m256i *hi) {
+    b = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    *lo = bitonic_clean8(_mm256_min_epu32(a, b));
+    *hi = bitonic_clean8(_mm256_max_epu32(a, b));
+}
+
+#define CMP_SWAP_U32(x, y) do { __m256i t_ = _mm256_min_epu32(x, y); y = _mm256_max_epu32(x, y); x = t_; } while (0)
+
+// 레지스터 m개(8m개 원소)에 걸친 비트닉 수열을 오름차순으로 정리
+__attribute__((target("avx2")))
+static inline void bitonic_clean_regs(__m256i *r, int m) {
+    for (int d = m / 2; d >= 1; d /= 2) {
+        for (int i = 0; i < m; i++) {
+            if (i % (2 * d) < d)
+                CMP_SWAP_U32(r[i], r[i + d]);
+        }
+    }
+    for (int i = 0; i < m; i++)
+        r[i] = bitonic_clean8(r[i]);
+}
+
+// 각각 레지스터 m개로 된 정렬된 두 수열 a, b를 병합 (작은 절반은 a, 큰 절반은 b)
+__attribute__((target("avx2")))
+static inline void bitonic_merge_regs(__m256i *a, __m256i *b, int m) {
+    const __m256i rev = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    __m256i rb[4];
+    for (int i = 0; i < m; i++)
+        rb[i] = _mm256_permutevar8x32_epi32(b[m - 1 - i], rev);
+    for (int i = 0; i < m; i++) {
+        b[i] = _mm256_max_epu32(a[i], rb[i]);
+        a[i] = _mm256_min_epu32(a[i], rb[i]);
+    }
+    bitonic_clean_regs(a, m);
+    bitonic_clean_regs(b, m);
+}
+
+// 64개 블록: 8개 레지스터의 열을 19단 정렬 네트워크로 정렬하고 8 x 8 전치한 뒤
+// 길이 8인 런 8개를 레지스터 안에서 비트닉 병합으로 16, 32, 64로 합친다
+__attribute__((target("avx2")))
+static void sort_block_avx2(uint32_t *keys, size_t n) {
+    if (n != WIDE_BLOCK) {
+        sort_block_scalar(keys, n);
+        return;
+    }
+
+    __m256i r0 = _mm256_loadu_si256((const __m256i *) (keys + 0));
+    __m256i r1 = _mm256_loadu_si256((const __m256i *) (keys + 8));
+    __m256i r2 = _mm256_loadu_si256((const __m256i *) (keys + 16));
+    __m256i r3 = _mm256_loadu_si256((const __m256i *) (keys + 24));
+    __m256i r4 = _mm256_loadu_si256((const __m256i *) (keys + 32));
+    __m256i r5 = _mm256_loadu_si256((const __m256i *) (keys + 40));
+    __m256i r6 = _mm256_loadu_si256((const __m256i *) (keys + 48));
+    __m256i r7 = _mm256_loadu_si256((const __m256i *) (keys + 56));
+
+    CMP_SWAP_U32(r0, r2); CMP_SWAP_U32(r1, r3); CMP_SWAP_U32(r4, r6); CMP_SWAP_U32(r5, r7);
+    CMP_SWAP_U32(r0, r4); CMP_SWAP_U32(r1, r5); CMP_SWAP_U32(r2, r6); CMP_SWAP_U32(r3, r7);
+    CMP_SWAP_U32(r0, r1); CMP_SWAP_U32(r2, r3); CMP_SWAP_U32(r4, r5); CMP_SWAP_U32(r6, r7);
+    CMP_SWAP_U32(r2, r4); CMP_SWAP_U32(r3, r5);
+    CMP_SWAP_U32(r1, r4); CMP_SWAP_U32(r3, r6);
+    CMP_SWAP_U32(r1, r2); CMP_SWAP_U32(r3, r4); CMP_SWAP_U32(r5, r6);
+
+    // 8 x 8 전치: 각 레지스터가 정렬된 열 하나가 됨
+    __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+    __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+    __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+    __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+    __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+    __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+    __m256i r[8];
+    r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+    r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+    r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+    r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+    r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+    r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+    r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+    r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+
+    // 길이 8 런 8개 -> 16 런 4개 -> 32 런 2개 -> 64 런 1개
+    bitonic_merge_regs(&r[0], &r[1], 1);
+    bitonic_merge_regs(&r[2], &r[3], 1);
+    bitonic_merge_regs(&r[4], &r[5], 1);
+    bitonic_merge_regs(&r[6], &r[7], 1);
+    bitonic_merge_regs(&r[0], &r[2], 2);
+    bitonic_merge_regs(&r[4], &r[6], 2);
+    bitonic_merge_regs(&r[0], &r[4], 4);
+
+    for (int i = 0; i < 8; i++)
+        _mm256_storeu_si256((__m256i *) (keys + 8 * i), r[i]);
+}
+
+// 레지스터 병합을 반복하는 벡터 병합: 다음 블록은 머리 원소가 작은 쪽에서 가져오고,
+// 한쪽에 8개 미만이 남으면 남은 원소를 스칼라로 병합한다
+__attribute__((target("avx2")))
+static void merge_u32_avx2(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+    if (na < 8 || nb < 8) {
+        merge_u32_scalar(a, na, b, nb, out);
+        return;
+    }
+
+    __m256i va = _mm256_loadu_si256((const __m256i *) a);
+    __m256i vb = _mm256_loadu_si256((const __m256i *) b);
+    size_t i = 8;
+    size_t j = 8;
+    __m256i lo;
+    __m256i hi;
+
+    for (;;) {
+        bitonic_merge8x8(va, vb, &lo, &hi);
+        _mm256_storeu_si256((__m256i *) out, lo);
+        out += 8;
+        vb = hi;
+
+        if (i < na && (j >= nb || a[i] <= b[j])) {
+            if (i + 8 > na)
+                break;
+            va = _mm256_loadu_si256((const __m256i *) (a + i));
+            i += 8;
+        } else if (j < nb) {
+            if (j + 8 > nb)
+                break;
+            va = _mm256_loadu_si256((const __m256i *) (b + j));
+            j += 8;
+        } else {
+            break;
+        }
+    }
+
+    // hi에 남은 8개와 두 배열의 꼬리를 스칼라로 병합
+    uint32_t rest[8];
+    size_t k = 0;
+    _mm256_storeu_si256((__m256i *) rest, hi);
+    while (k < 8 || i < na || j < nb) {
+        uint32_t best = UINT32_MAX;
+        int from = -1;
+        if (k < 8) {
+            best = rest[k];
+            from = 0;
+        }
+        if (i < na && (from < 0 || a[i] < best)) {
+            best = a[i];
+            from = 1;
+        }
+        if (j < nb && (from < 0 || b[j] < best)) {
+            best = b[j];
+            from = 2;
+        }
+        *out++ = best;
+        if (from == 0)
+            k++;
+        else if (from == 1)
+            i++;
+        else
+            j++;
+    }
+}
+
+#undef CMP_SWAP_U32
+
+#endif
+
+// use_avx2가 0이면 스칼라 커널, 아니면 AVX2 커널을 고름 (CPU가 지원하지 않으면 0 반환)
+static int select_wide_kernels(int use_avx2) {
+    sort_block_u32 = sort_block_scalar;
+    merge_u32 = merge_u32_scalar;
+    if (!use_avx2)
+        return 1;
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        sort_block_u32 = sort_block_avx2;
+        merge_u32 = merge_u32_avx2;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// AVX2를 지원하면 벡터 커널, 아니면 스칼라 커널 (KU_PSORT_SCALAR 환경 변수로 강제 가능)
+void init_simd_dispatch(void) {
+    select_wide_kernels(getenv("KU_PSORT_SCALAR") == NULL);
+}
+
+// WIDE_BLOCK 단위로 블록 정렬한 뒤 길이를 두 배씩 늘리며 keys와 tmp 사이를 오가며 병합
+void sort_run_u32(uint32_t *keys, uint32_t *tmp, size_t n) {
+    for (size_t i = 0; i < n; i += WIDE_BLOCK)
+        sort_block_u32(keys + i, n - i < WIDE_BLOCK ? n - i : WIDE_BLOCK);
+
+    uint32_t *src = keys;
+    uint32_t *dst = tmp;
+    for (size_t width = WIDE_BLOCK; width < n; width *= 2) {
+        for (size_t i = 0; i < n; i += 2 * width) {
+            size_t na = n - i < width ? n - i : width;
+            size_t nb = n - i - na < width ? n - i - na : width;
+            merge_u32(src + i, na, src + i + na, nb, dst + i);
+        }
+        uint32_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != keys)
+        memcpy(keys, src, n * sizeof(uint32_t));
+}
+
+// 자기 구간의 키를 직접 읽어 정렬된 런으로 만듦
+void *wide_thread_func(void *arg) {
+    wide_arg *task = (wide_arg *) arg;
+    if (task->count == 0)
+        return NULL;
+
+    int fd = open(task->file_name, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(fd, (unsigned char *) task->keys, task->count * sizeof(uint32_t), task->offset) < 0) {
+        perror("read");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    sort_run_u32(task->keys, task->tmp, task->count);
+    return NULL;
+}
+
+// 4바이트 키 정렬: 스레드마다 런을 만들고 주 스레드가 런을 차례로 병합 (리틀 엔디언 호스트 기준)
+int run_wide_sort(char *input, char *output, int n) {
+    bmp_info info;
+    if (find_bmp_info(input, &info) < 0 || info.bpp != 32) {
+        fprintf(stderr, "4바이트 키 정렬은 32비트 BMP만 지원합니다.\n");
+        return -1;
+    }
+
+    off_t size = find_size(n, input);
+    size_t count = (size_t) size / sizeof(uint32_t);
+    unsigned char *header = (unsigned char *) malloc((size_t) info.offset + 1);
+    unsigned char *tail = (unsigned char *) malloc(sizeof(uint32_t));
+    // keys/tmp의 각 구간은 그 구간을 읽고 정렬하는 작업 스레드가 처음 건드림
+    uint32_t *keys = (uint32_t *) alloc_large(count * sizeof(uint32_t));
+    uint32_t *tmp = (uint32_t *) alloc_large(count * sizeof(uint32_t));
+    wide_arg *tasks = (wide_arg *) malloc(n * sizeof(wide_arg));
+    pthread_t *thread_ids = (pthread_t *) malloc(n * sizeof(pthread_t));
+    if (header == NULL || tail == NULL || tasks == NULL || thread_ids == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        size_t begin = count * i / n;
+        size_t end = count * (i + 1) / n;
+        tasks[i].file_name = input;
+        tasks[i].offset = info.offset + (off_t) (begin * sizeof(uint32_t));
+        tasks[i].keys = keys + begin;
+        tasks[i].tmp = tmp + begin;
+        tasks[i].count = end - begin;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&thread_ids[i], NULL, wide_thread_func, &tasks[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // 헤더와 4바이트로 나누어떨어지지 않는 꼬리는 그대로 복사
+    size_t tail_len = (size_t) size - count * sizeof(uint32_t);
+    int read_fd = open(input, O_RDONLY | O_BINARY);
+    if (read_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (read_full(read_fd, header, (size_t) info.offset, 0) < 0 ||
+        read_full(read_fd, tail, tail_len, info.offset + (off_t) (count * sizeof(uint32_t))) < 0) {
+        perror("read");
+        close(read_fd);
+        exit(EXIT_FAILURE);
+    }
+    close(read_fd);
+
+    for (int i = 0; i < n; i++) {
+        if (pthread_join(thread_ids[i], NULL) != 0) {
+            perror("pthread_join");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // 런 병합: 출력을 스레드 수만큼 같은 크기로 나누어 병렬로 병합 (tmp는 보조 버퍼로 재사용)
+    uint32_t **runs = (uint32_t **) malloc(n * sizeof(uint32_t *));
+    size_t *lens = (size_t *) malloc(n * sizeof(size_t));
+    // 출력 구간도 그 구간을 병합하는 스레드가 처음 건드림
+    uint32_t *src = (uint32_t *) alloc_large(count * sizeof(uint32_t));
+    if (runs == NULL || lens == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < n; i++) {
+        runs[i] = tasks[i].keys;
+        lens[i] = tasks[i].count;
+    }
+    merge_runs_parallel(runs, lens, n, src, tmp, n);
+    free(lens);
+    free(runs);
+
+    int write_fd = open(output, O_WRONLY | O_BINARY | O_TRUNC | O_CREAT, 0777);
+    if (write_fd < 0) {
+        perror("open");
+        exit(EXIT_FAILURE);
+    }
+    if (write_full(write_fd, header, (size_t) info.offset) < 0 ||
+        write_full(write_fd, (const unsigned char *) src, count * sizeof(uint32_t)) < 0 ||
+        write_full(write_fd, tail, tail_len) < 0) {
+        perror("write");
+        close(write_fd);
+        exit(EXIT_FAILURE);
+    }
+    drop_output_cache(write_fd);
+    close(write_fd);
+
+    free_large(src, count * sizeof(uint32_t));
+    free(thread_ids);
+    free(tasks);
+    free_large(tmp, count * sizeof(uint32_t));
+    free_large(keys, count * sizeof(uint32_t));
+    free(tail);
+    free(header);
+    return 0;
+}
+
+static size_t lower_bound_u32(const uint32_t *a, size_t n, uint32_t v) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static size_t upper_bound_u32(const uint32_t *a, size_t n, uint32_t v) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a[mid] <= v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// 값에 대한 이분 탐색으로 "v 이하가 target개 이상"인 가장 작은 v를 찾고,
+// v보다 작은 원소는 모두 앞쪽에, v와 같은 원소는 런 순서대로 남은 자리만큼 앞쪽에 둔다
+void co_rank(uint32_t **runs, const size_t *lens, int k, size_t target, size_t *split) {
+    uint64_t lo = 0;
+    uint64_t hi = UINT32_MAX;
+
+    if (target == 0) {
+        for (int i = 0; i < k; i++)
+            split[i] = 0;
+        return;
+    }
+
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        size_t le = 0;
+        for (int i = 0; i < k; i++)
+            le += upper_bound_u32(runs[i], lens[i], (uint32_t) mid);
+        if (le >= target)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    size_t taken = 0;
+    for (int i = 0; i < k; i++) {
+        split[i] = lower_bound_u32(runs[i], lens[i], (uint32_t) lo);
+        taken += split[i];
+    }
+    for (int i = 0; i < k && taken < target; i++) {
+        size_t eq = upper_bound_u32(runs[i], lens[i], (uint32_t) lo) - split[i];
+        size_t add = eq < target - taken ? eq : target - taken;
+        split[i] += add;
+        taken += add;
+    }
+}
+
+// 자기 출력 구간의 양 끝 co-rank를 구한 뒤, 런 조각들을 벡터 병합으로 두 개씩 합침
+void *merge_path_func(void *arg) {
+    merge_path_arg *task = (merge_path_arg *) arg;
+    int k = task->k;
+    size_t *lo = (size_t *) malloc(k * sizeof(size_t));
+    size_t *hi = (size_t *) malloc(k * sizeof(size_t));
+    const uint32_t **ptrs = (const uint32_t **) malloc(k * sizeof(uint32_t *));
+    size_t *lens = (size_t *) malloc(k * sizeof(size_t));
+    if (lo == NULL || hi == NULL || ptrs == NULL || lens == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    co_rank(task->runs, task->lens, k, task->begin, lo);
+    co_rank(task->runs, task->lens, k, task->end, hi);
+
+    // 빈 조각은 빼고 모음
+    int pieces = 0;
+    for (int i = 0; i < k; i++) {
+        if (hi[i] > lo[i]) {
+            ptrs[pieces] = task->runs[i] + lo[i];
+            lens[pieces] = hi[i] - lo[i];
+            pieces++;
+        }
+    }
+
+    // 병합 단계 수가 홀수면 out부터, 짝수면 scratch부터 써서 마지막 결과가 out에 오게 함
+    uint32_t *out = task->out + task->begin;
+    uint32_t *scratch = task->scratch + task->begin;
+    int levels = 0;
+    for (int p = pieces; p > 1; p = (p + 1) / 2)
+        levels++;
+    uint32_t *dst = levels % 2 == 1 ? out : scratch;
+
+    if (pieces == 1)
+        memcpy(out, ptrs[0], lens[0] * sizeof(uint32_t));
+    while (pieces > 1) {
+        size_t pos = 0;
+        int next = 0;
+        for (int i = 0; i < pieces; i += 2) {
+            size_t len = lens[i] + (i + 1 < pieces ? lens[i + 1] : 0);
+            if (i + 1 < pieces)
+                merge_u32(ptrs[i], lens[i], ptrs[i + 1], lens[i + 1], dst + pos);
+            else
+                memcpy(dst + pos, ptrs[i], lens[i] * sizeof(uint32_t));
+            ptrs[next] = dst + pos;
+            lens[next] = len;
+            next++;
+            pos += len;
+        }
+        pieces = next;
+        dst = dst == out ? scratch : out;
+    }
+
+    free(lens);
+    free(ptrs);
+    free(hi);
+    free(lo);
+    return NULL;
+}
+
+// 출력 [N * p / n, N * (p + 1) / n) 구간마다 스레드 하나: 구간 경계는 각자 co-rank로 구함
+void merge_runs_parallel(uint32_t **runs, size_t *lens, int k, uint32_t *out, uint32_t *scratch, int n) {
+    size_t total = 0;
+    for (int i = 0; i < k; i++)
+        total += lens[i];
+
+    merge_path_arg *tasks = (merge_path_arg *) malloc(n * sizeof(merge_path_arg));
+    pthread_t *thread_ids = (pthread_t *) malloc(n * sizeof(pthread_t));
+    if (tasks == NULL || thread_ids == NULL) {
+        perror("메모리 할당 실패");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int p = 0; p < n; p++) {
+        tasks[p].runs = runs;
+        tasks[p].lens = lens;
+        tasks[p].k = k;
+        tasks[p].begin = total * p / n;
+        tasks[p].end = total * (p + 1) / n;
+        tasks[p].out = out;
+        tasks[p].scratch = scratch;
+        if (pthread_create(&thread_ids[p], NULL, merge_path_func, &tasks[p]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int p = 0; p < n; p++) {
+        if (pthread_join(thread_ids[p], NULL) != 0) {
+            perror("pthread_join");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    free(thread_ids);
+    free(tasks);
+}
+
+// 자체 검사용 xorshift64 (매 실행 같은 입력)
+static uint64_t self_test_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// 0: 무작위, 1: 서로 다른 값 4개, 2: 이미 정렬됨, 3: 역순, 4: UINT32_MAX 근처
+static void self_test_fill(uint32_t *keys, size_t n, int pattern, uint64_t *state) {
+    for (size_t i = 0; i < n; i++) {
+        uint32_t r = (uint32_t) self_test_next(state);
+        switch (pattern) {
+            case 0: keys[i] = r; break;
+            case 1: keys[i] = (r & 3) * 0x40000000u; break;
+            case 2: keys[i] = (uint32_t) i * 3; break;
+            case 3: keys[i] = (uint32_t) (n - i); break;
+            default: keys[i] = UINT32_MAX - (r & 15); break;
+        }
+    }
+}
+
+int run_self_test(void) {
+    static const size_t sizes[] = {0, 1, 7, 63, 64, 65, 100, 1000, 4097, 100003};
+    static const int run_counts[] = {1, 3, 7};
+    static const int thread_counts[] = {1, 4};
+    static const char *pattern_names[] = {"random", "few-distinct", "sorted", "reverse", "near-max"};
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    int failures = 0;
+    int cases = 0;
+
+    for (int path = 0; path < 2; path++) {
+        if (!select_wide_kernels(path)) {
+            fprintf(stderr, "자체 검사: AVX2를 지원하지 않아 벡터 커널은 건너뜀\n");
+            continue;
+        }
+        const char *path_name = path ? "avx2" : "scalar";
+
+        for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); si++) {
+            size_t n = sizes[si];
+            uint32_t *keys = (uint32_t *) malloc(n * sizeof(uint32_t) + 1);
+            uint32_t *expect = (uint32_t *) malloc(n * sizeof(uint32_t) + 1);
+            uint32_t *tmp = (uint32_t *) malloc(n * sizeof(uint32_t) + 1);
+            uint32_t *out = (uint32_t *) malloc(n * sizeof(uint32_t) + 1);
+            if (keys == NULL || expect == NULL || tmp == NULL || out == NULL) {
+                perror("메모리 할당 실패");
+                exit(EXIT_FAILURE);
+            }
+
+            for (int pattern = 0; pattern < 5; pattern++) {
+                self_test_fill(expect, n, pattern, &state);
+                memcpy(keys, expect, n * sizeof(uint32_t));
+                qsort(expect, n, sizeof(uint32_t), compare_u32);
+
+                // 한 런 전체 정렬
+                sort_run_u32(keys, tmp, n);
+                cases++;
+                if (memcmp(keys, expect, n * sizeof(uint32_t)) != 0) {
+                    fprintf(stderr, "자체 검사 실패: sort_run_u32 %s %s n=%zu\n", path_name, pattern_names[pattern], n);
+                    failures++;
+                }
+
+                // 길이가 고르지 않은 런 k개로 나누어 정렬한 뒤 병렬 병합
+                for (size_t ki = 0; ki < sizeof(run_counts) / sizeof(run_counts[0]); ki++) {
+                    int k = run_counts[ki];
+                    uint32_t *runs[7];
+                    size_t lens[7];
+                    self_test_fill(keys, n, pattern, &state);
+                    memcpy(expect, keys, n * sizeof(uint32_t));
+                    qsort(expect, n, sizeof(uint32_t), compare_u32);
+
+                    size_t begin = 0;
+                    for (int r = 0; r < k; r++) {
+                        size_t end = r == k - 1 ? n : begin + (n - begin) / (size_t) (k - r + 1);
+                        runs[r] = keys + begin;
+                        lens[r] = end - begin;
+                        sort_run_u32(runs[r], tmp + begin, lens[r]);
+                        begin = end;
+                    }
+                    for (size_t ti = 0; ti < sizeof(thread_counts) / sizeof(thread_counts[0]); ti++) {
+                        memset(out, 0, n * sizeof(uint32_t));
+                        merge_runs_parallel(runs, lens, k, out, tmp, thread_counts[ti]);
+                        cases++;
+                        if (memcmp(out, expect, n * sizeof(uint32_t)) != 0) {
+                            fprintf(stderr, "자체 검사 실패: merge_runs_parallel %s %s n=%zu 런 %d개 스레드 %d개\n",
+                                    path_name, pattern_names[pattern], n, k, thread_counts[ti]);
+                            failures++;
+                        }
+                    }
+                }
+            }
+
+            free(out);
+            free(tmp);
+            free(expect);
+            free(keys);
+        }
+    }
+
+    init_simd_dispatch();
+    fprintf(stderr, "자체 검사: %d개 경우 중 실패 %d개\n", cases, failures);
+    return failures;
+}
+